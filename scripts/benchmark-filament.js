@@ -0,0 +1,309 @@
+/*
+ * Copyright 2019 Google Inc. All Rights Reserved.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Benchmarks gltf_renderer against the fidelity scenarios.
+ *
+ * Every repetition renders the chosen scenarios in a single renderer process,
+ * twice each: the first ("cold") render of a scenario pays for loading its
+ * IBL, while the second ("warm") one reuses everything the process has
+ * already loaded. The per-stage timings reported by gltf_renderer --stats are
+ * aggregated across repetitions, and optionally compared to a baseline
+ * recorded by an earlier run.
+ *
+ * Usage:
+ *
+ *   node ./scripts/benchmark-filament.js [--repetitions=<count>]
+ *       [--width=<pixels>] [--height=<pixels>] [--output=<results.json>]
+ *       [--baseline=<results.json>] [<scenario slug>...]
+ */
+
+const ALERT_THRESHOLD = 0.1;
+
+const fs = require('fs').promises;
+const {spawn} = require('child_process');
+const os = require('os');
+const path = require('path');
+const {fidelityTestDirectory, readScenarioSources, writeJobList} =
+    require('./filament-render-farm.js');
+
+const warn = (message) => console.warn(`🚨 ${message}`);
+const exit = (code = 0) => {
+  console.log(`📋 Benchmark concluded`);
+  process.exit(code);
+};
+
+const filamentScreenshotScript =
+    path.resolve('./scripts/filament-screenshot.sh');
+
+// The stages that make up the time it takes to produce a screenshot
+const RENDER_STAGES = ['iblLoad', 'modelLoad', 'textureDecode', 'warmup'];
+
+const parseArguments = (args) => {
+  const options = {
+    repetitions: 5,
+    width: null,
+    height: null,
+    output: path.resolve('./benchmark-results.json'),
+    baseline: null,
+    scenarios: []
+  };
+
+  for (const arg of args) {
+    const match =
+        arg.match(/^--(repetitions|width|height|output|baseline)=(.*)$/);
+
+    if (match == null) {
+      options.scenarios.push(arg);
+      continue;
+    }
+
+    const [, name, value] = match;
+
+    switch (name) {
+      case 'repetitions':
+        options.repetitions = Math.max(1, parseInt(value, 10));
+        break;
+      case 'width':
+      case 'height':
+        options[name] = parseInt(value, 10);
+        break;
+      case 'output':
+      case 'baseline':
+        options[name] = path.resolve(value);
+        break;
+    }
+  }
+
+  return options;
+};
+
+const run = async (command, args) => new Promise((resolve, reject) => {
+  const childProcess = spawn(command, args, {
+    cwd: process.cwd(),
+    env: process.env,
+    stdio: ['ignore', 'inherit', 'inherit']
+  });
+
+  childProcess.once('error', (error) => {
+    warn(error);
+  });
+
+  childProcess.once('exit', (code) => {
+    if (code === 0) {
+      resolve();
+    } else {
+      reject(new Error('Command failed'));
+    }
+  });
+});
+
+const summarize = (values) => {
+  const mean = values.reduce((sum, value) => sum + value, 0) / values.length;
+  const variance =
+      values.reduce((sum, value) => sum + (value - mean) * (value - mean), 0) /
+      values.length;
+
+  return {
+    mean,
+    standardDeviation: Math.sqrt(variance),
+    min: Math.min(...values),
+    max: Math.max(...values)
+  };
+};
+
+const renderTime = (stats) =>
+    RENDER_STAGES.reduce((sum, stage) => sum + stats[stage], 0);
+
+const collectJobs = async (config, options, outputDirectory) => {
+  const requestedScenarios = new Set(options.scenarios);
+  const jobs = [];
+
+  for (const scenario of config.scenarios) {
+    const {slug} = scenario;
+
+    if (requestedScenarios.size > 0 && !requestedScenarios.has(slug)) {
+      continue;
+    }
+
+    const {backgroundImagePath, modelSourcePath} =
+        await readScenarioSources(slug);
+
+    if (backgroundImagePath == null || modelSourcePath == null) {
+      warn(`Could not determine the sources of ${slug}; skipping...`);
+      continue;
+    }
+
+    const width = options.width || scenario.dimensions.width;
+    const height = options.height || scenario.dimensions.height;
+
+    for (const pass of ['cold', 'warm']) {
+      jobs.push({
+        slug,
+        pass,
+        width,
+        height,
+        backgroundImagePath,
+        modelSourcePath,
+        filePath: path.join(outputDirectory, `${slug}-${pass}.png`)
+      });
+    }
+  }
+
+  return jobs;
+};
+
+const benchmark = async (config, options) => {
+  const outputDirectory =
+      await fs.mkdtemp(path.join(os.tmpdir(), 'filament-benchmark-'));
+  const jobListPath = path.join(outputDirectory, 'jobs.tsv');
+  const statsPath = path.join(outputDirectory, 'stats.json');
+
+  const jobs = await collectJobs(config, options, outputDirectory);
+
+  if (jobs.length === 0) {
+    throw new Error('No scenarios to benchmark');
+  }
+
+  await writeJobList(jobListPath, jobs);
+
+  const samples = new Map();
+  const processTimes = [];
+
+  console.log(`⏱  Benchmarking ${jobs.length / 2} scenario(s) over ${
+      options.repetitions} repetition(s)...`);
+
+  for (let i = 0; i < options.repetitions; ++i) {
+    const start = process.hrtime.bigint();
+    await run(filamentScreenshotScript, ['-j', jobListPath, '-S', statsPath]);
+    processTimes.push(Number(process.hrtime.bigint() - start) / 1e6);
+
+    const stats = JSON.parse(await fs.readFile(statsPath));
+
+    stats.jobs.forEach((jobStats, index) => {
+      const {slug, pass} = jobs[index];
+      const key = `${slug}\t${pass}`;
+
+      if (!samples.has(key)) {
+        samples.set(key, {renderTimes: [], framesPerSecond: []});
+      }
+
+      const sample = samples.get(key);
+      sample.renderTimes.push(renderTime(jobStats));
+
+      if (jobStats.averageFrame > 0) {
+        sample.framesPerSecond.push(1000 / jobStats.averageFrame);
+      }
+    });
+  }
+
+  const scenarios = {};
+
+  for (const [key, sample] of samples) {
+    const [slug, pass] = key.split('\t');
+
+    scenarios[slug] = scenarios[slug] || {};
+    scenarios[slug][pass] = {
+      renderTime: summarize(sample.renderTimes),
+      framesPerSecond: sample.framesPerSecond.length > 0 ?
+          summarize(sample.framesPerSecond) :
+          null
+    };
+  }
+
+  const processTime = summarize(processTimes);
+
+  await fs.unlink(jobListPath);
+  await fs.unlink(statsPath);
+  for (const job of jobs) {
+    await fs.unlink(job.filePath).catch(() => {});
+  }
+  await fs.rmdir(outputDirectory);
+
+  return {
+    repetitions: options.repetitions,
+    processTime,
+    scenesPerMinute: jobs.length / (processTime.mean / 60000),
+    scenarios
+  };
+};
+
+const compareToBaseline = (results, baseline) => {
+  let regressions = 0;
+
+  for (const slug in results.scenarios) {
+    if (baseline.scenarios[slug] == null) {
+      warn(`Baseline does not include scenario "${slug}"`);
+      continue;
+    }
+
+    for (const pass of ['cold', 'warm']) {
+      const candidate = results.scenarios[slug][pass].renderTime.mean;
+      const reference = baseline.scenarios[slug][pass].renderTime.mean;
+      const change = (candidate - reference) / reference;
+
+      if (change > ALERT_THRESHOLD) {
+        warn(`${slug} (${pass}) got ${(change * 100).toFixed(1)}% slower: ${
+            reference.toFixed(1)}ms -> ${candidate.toFixed(1)}ms`);
+        regressions++;
+      }
+    }
+  }
+
+  const change = (baseline.scenesPerMinute - results.scenesPerMinute) /
+      baseline.scenesPerMinute;
+
+  if (change > ALERT_THRESHOLD) {
+    warn(`Throughput dropped by ${(change * 100).toFixed(1)}%: ${
+        baseline.scenesPerMinute.toFixed(1)} -> ${
+        results.scenesPerMinute.toFixed(1)} scenes per minute`);
+    regressions++;
+  }
+
+  return regressions;
+};
+
+const options = parseArguments(process.argv.slice(2));
+
+benchmark(require(path.join(fidelityTestDirectory, 'config.json')), options)
+    .then(async (results) => {
+      for (const slug in results.scenarios) {
+        const {cold, warm} = results.scenarios[slug];
+        console.log(`📈 ${slug}: cold ${cold.renderTime.mean.toFixed(1)}ms ±${
+            cold.renderTime.standardDeviation.toFixed(1)}, warm ${
+            warm.renderTime.mean.toFixed(1)}ms ±${
+            warm.renderTime.standardDeviation.toFixed(1)}`);
+      }
+
+      console.log(`🚚 ${results.scenesPerMinute.toFixed(1)} scenes per minute`);
+
+      await fs.writeFile(options.output, JSON.stringify(results, null, 2));
+      console.log(`💾 Results written to ${options.output}`);
+
+      if (options.baseline != null) {
+        const baseline = JSON.parse(await fs.readFile(options.baseline));
+        const regressions = compareToBaseline(results, baseline);
+
+        if (regressions > 0) {
+          exit(1);
+        }
+      }
+
+      exit(0);
+    })
+    .catch((error) => {
+      console.error(error);
+      exit(1);
+    });
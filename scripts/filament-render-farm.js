@@ -0,0 +1,280 @@
+/*
+ * Copyright 2019 Google Inc. All Rights Reserved.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Schedules Filament screenshot jobs across a pool of workers. Each worker
+ * repeatedly takes a batch of jobs off a shared queue and renders it with a
+ * single filament-screenshot.sh (and so gltf_renderer) process. Workers are
+ * assigned to GPUs round-robin by pointing them at the X display of a GPU.
+ *
+ * When a batch fails or times out, its jobs are put back on the queue one by
+ * one so that a single bad scenario cannot take its whole batch down with it.
+ * Only a job that fails on its own uses up one of its retries.
+ */
+
+const fs = require('fs').promises;
+const {spawn} = require('child_process');
+const os = require('os');
+const path = require('path');
+
+const warn = (message) => console.warn(`🚨 ${message}`);
+
+const filamentScreenshotScript =
+    path.resolve('./scripts/filament-screenshot.sh');
+
+const fidelityTestDirectory = path.resolve('./test/fidelity');
+const backgroundImageRe = /background-image\="([^"]+)"/;
+const modelSourceRe = /src\="([^"]+)"/;
+
+const DEFAULT_OPTIONS = {
+  // Upper bound on concurrently running renderer processes
+  workers: 1,
+  // X displays (e.g. ':0.0,:0.1') of the GPUs that workers are spread over;
+  // empty means every worker uses the inherited display
+  gpus: [],
+  // Maximum number of jobs rendered by one renderer process
+  batchSize: 8,
+  // Number of times a failing job is retried on its own
+  retries: 2,
+  // Seconds a renderer process may take per job in its batch
+  timeout: 120
+};
+
+/**
+ * Parses --workers=, --gpus=, --batch-size=, --retries= and --timeout= out of
+ * the given argument list. Returns the options and the remaining arguments.
+ */
+const parseRenderFarmArguments = (args) => {
+  const options = Object.assign({}, DEFAULT_OPTIONS);
+  const remainingArgs = [];
+  let workersSpecified = false;
+
+  for (const arg of args) {
+    const match =
+        arg.match(/^--(workers|gpus|batch-size|retries|timeout)=(.*)$/);
+
+    if (match == null) {
+      remainingArgs.push(arg);
+      continue;
+    }
+
+    const [, name, value] = match;
+
+    switch (name) {
+      case 'workers':
+        options.workers = Math.max(1, parseInt(value, 10));
+        workersSpecified = true;
+        break;
+      case 'gpus':
+        options.gpus = value.split(',').filter(gpu => gpu.length > 0);
+        break;
+      case 'batch-size':
+        options.batchSize = Math.max(1, parseInt(value, 10));
+        break;
+      case 'retries':
+        options.retries = Math.max(0, parseInt(value, 10));
+        break;
+      case 'timeout':
+        options.timeout = Math.max(1, parseFloat(value));
+        break;
+    }
+  }
+
+  if (!workersSpecified && options.gpus.length > 0) {
+    options.workers = options.gpus.length;
+  }
+
+  return {options, remainingArgs};
+};
+
+/**
+ * Resolves the IBL and model that a fidelity scenario's index.html points
+ * <model-viewer> at, either of which may be null if it cannot be determined.
+ */
+const readScenarioSources = async (slug) => {
+  const scenarioDirectory = path.join(fidelityTestDirectory, slug);
+  const testHtmlPath = path.join(scenarioDirectory, 'index.html');
+
+  const html = (await fs.readFile(testHtmlPath)).toString();
+
+  const backgroundImageMatch = html.match(backgroundImageRe);
+  const modelSourceMatch = html.match(modelSourceRe);
+
+  return {
+    scenarioDirectory,
+    backgroundImagePath: backgroundImageMatch != null ?
+        path.resolve(scenarioDirectory, backgroundImageMatch[1]) :
+        null,
+    modelSourcePath: modelSourceMatch != null ?
+        path.resolve(scenarioDirectory, modelSourceMatch[1]) :
+        null
+  };
+};
+
+/**
+ * Writes the job list format understood by filament-screenshot.sh -j
+ */
+const writeJobList = async (jobListPath, jobs) => {
+  const jobList = jobs.map(
+      (job) => [
+        job.width,
+        job.height,
+        job.backgroundImagePath,
+        job.filePath,
+        job.modelSourcePath
+      ].join('\t'));
+
+  await fs.writeFile(jobListPath, `${jobList.join('\n')}\n`);
+};
+
+const runBatch = async (jobs, environment, timeout) => {
+  const jobListDirectory =
+      await fs.mkdtemp(path.join(os.tmpdir(), 'filament-screenshots-'));
+  const jobListPath = path.join(jobListDirectory, 'jobs.tsv');
+
+  await writeJobList(jobListPath, jobs);
+
+  try {
+    await new Promise((resolve, reject) => {
+      // The child gets its own process group so that a timeout also takes
+      // down the gltf_renderer process spawned by the script
+      const childProcess =
+          spawn(filamentScreenshotScript, ['-j', jobListPath], {
+            cwd: process.cwd(),
+            env: environment,
+            detached: true,
+            stdio: ['ignore', 'inherit', 'inherit']
+          });
+
+      const timer = setTimeout(() => {
+        warn(`Renderer timed out after ${timeout}s; terminating`);
+        try {
+          process.kill(-childProcess.pid, 'SIGKILL');
+        } catch (error) {
+          warn(error);
+        }
+      }, timeout * 1000);
+
+      childProcess.once('error', (error) => {
+        warn(error);
+      });
+
+      childProcess.once('exit', (code) => {
+        clearTimeout(timer);
+
+        if (code === 0) {
+          resolve();
+        } else {
+          reject(new Error('Failed to capture Filament screenshots'));
+        }
+      });
+    });
+  } finally {
+    await fs.unlink(jobListPath);
+    await fs.rmdir(jobListDirectory);
+  }
+};
+
+/**
+ * Renders all of the given jobs, resolving once every job has either
+ * succeeded or exhausted its retries. Rejects if any job ultimately failed.
+ */
+const renderFilamentScreenshots = async (jobs, options = DEFAULT_OPTIONS) => {
+  if (jobs.length === 0) {
+    return;
+  }
+
+  const {workers, gpus, batchSize, retries, timeout} = options;
+  const queue = jobs.map(job => ({job, attempts: 0, alone: false}));
+  const failures = [];
+
+  const workerCount = Math.min(workers, jobs.length);
+
+  console.log(`🖌️  Rendering ${jobs.length} Filament screenshot(s) with ${
+      workerCount} worker(s)...`);
+
+  const work = async (workerIndex) => {
+    const environment = Object.assign({}, process.env);
+
+    if (gpus.length > 0) {
+      environment.DISPLAY = gpus[workerIndex % gpus.length];
+    }
+
+    while (queue.length > 0) {
+      // The jobs of a failed batch are retried on their own
+      const batch = [queue.shift()];
+
+      while (!batch[0].alone && batch.length < batchSize &&
+             queue.length > 0 && !queue[0].alone) {
+        batch.push(queue.shift());
+      }
+
+      try {
+        await runBatch(
+            batch.map(entry => entry.job), environment, timeout * batch.length);
+
+        for (const {job} of batch) {
+          console.log(`✅ Successfully captured screenshot for ${job.name} ${
+              job.slug}`);
+        }
+      } catch (error) {
+        // A single bad model fails its whole batch, so the attempt is only
+        // counted once the jobs have been rendered one at a time
+        if (batch.length > 1) {
+          warn(`Batch of ${
+              batch.length} jobs failed; retrying them one by one`);
+          for (const entry of batch) {
+            entry.alone = true;
+            queue.push(entry);
+          }
+          continue;
+        }
+
+        const [entry] = batch;
+        entry.attempts++;
+        entry.alone = true;
+
+        if (entry.attempts > retries) {
+          warn(`Giving up on ${entry.job.slug} after ${
+              entry.attempts} attempt(s)`);
+          failures.push(entry.job);
+        } else {
+          queue.push(entry);
+        }
+      }
+    }
+  };
+
+  const pool = [];
+
+  for (let i = 0; i < workerCount; ++i) {
+    pool.push(work(i));
+  }
+
+  await Promise.all(pool);
+
+  if (failures.length > 0) {
+    throw new Error(`Failed to capture Filament screenshots for ${
+        failures.map(job => job.slug).join(', ')}`);
+  }
+};
+
+module.exports = {
+  fidelityTestDirectory,
+  parseRenderFarmArguments,
+  readScenarioSources,
+  renderFilamentScreenshots,
+  writeJobList
+};
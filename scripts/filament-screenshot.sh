@@ -23,11 +23,32 @@ Usage:
 
   filament-screenshot.sh -i <ibl input file> -m <model path> -o <output file> \
       [-w <render width>] [-h <render height>] [-r <renderer install path>] \
-      [-vI]
+      [-S <stats file>] [-D <digests file>] [-P <profile>] [-B <backend>] \
+      [-vIHC]
+
+  filament-screenshot.sh -j <job list> [-r <renderer install path>] \
+      [-S <stats file>] [-D <digests file>] [-P <profile>] [-B <backend>] \
+      [-vIHC]
+
+A job list describes one screenshot per line as tab-separated fields:
+
+  <render width> <render height> <ibl input file> <output file> <model path>
+
+All jobs in a job list are rendered by a single gltf_renderer process.
 
 Note: script caches Filament repo and non-screenshot artifacts across
-multiple invocations. To force regeneration of the IBL, add the -I flag (be
-aware that this will take longer).';
+multiple invocations. IBLs are cached by the contents of their input file and
+the cmgen settings. To force regeneration of the IBL anyway, add the -I flag (be
+aware that this will take longer). Add the -H flag to render without showing a
+window, at exactly the requested dimensions regardless of display scaling. Add
+the -C flag to keep existing screenshots and only overwrite those that no longer
+match the new render. Add -S <stats file> to have gltf_renderer write per-stage
+timings to the given JSON file. Add -D <digests file> to skip screenshots whose
+inputs have not changed since they were recorded in the file, and to leave
+screenshots whose pixels have not changed untouched. Add -P preview for a quick
+smoke render without shadows, MSAA or post-processing; the default golden
+profile is what the fidelity tests compare against. Add -B vulkan (or metal on macOS) to render
+with another Filament backend than OpenGL.';
 }
 
 if [ -z "$MODEL_VIEWER_CHECKOUT_DIRECTORY" ]; then
@@ -44,9 +65,12 @@ MODEL_PATH=""
 RENDER_WIDTH=768
 RENDER_HEIGHT=768
 SCREENSHOT_OUTPUT_FILE=""
+JOB_LIST_FILE=""
+COMPARE_TO_EXISTING=false
+RENDERER_FLAGS=()
 VERBOSE=false
 
-while getopts "?vw:h:i:m:o:IF" opt; do
+while getopts "?vr:w:h:i:m:o:j:S:D:P:B:IFHC" opt; do
     case "$opt" in
     \?)
         showUsage
@@ -66,8 +90,23 @@ while getopts "?vw:h:i:m:o:IF" opt; do
         ;;
     o)  SCREENSHOT_OUTPUT_FILE=$OPTARG
         ;;
+    j)  JOB_LIST_FILE=$OPTARG
+        ;;
     I)  REGENERATE_IBL=true
         ;;
+    H)  RENDERER_FLAGS+=(--headless)
+        ;;
+    S)  RENDERER_FLAGS+=(--stats="$OPTARG")
+        ;;
+    D)  RENDERER_FLAGS+=(--digests="$OPTARG")
+        ;;
+    P)  RENDERER_FLAGS+=(--profile="$OPTARG")
+        ;;
+    B)  RENDERER_FLAGS+=(--backend="$OPTARG")
+        ;;
+    C)  COMPARE_TO_EXISTING=true
+        RENDERER_FLAGS+=(--compare)
+        ;;
     esac
 done
 
@@ -75,8 +114,13 @@ shift $((OPTIND-1))
 
 [ "${1:-}" = "--" ] && shift
 
-if [ -z "$IBL_INPUT_FILE" ] || [ -z "$MODEL_PATH" ] || [ -z "$SCREENSHOT_OUTPUT_FILE" ]; then
-  showUsage
+if [ -z "$JOB_LIST_FILE" ]; then
+  if [ -z "$IBL_INPUT_FILE" ] || [ -z "$MODEL_PATH" ] || [ -z "$SCREENSHOT_OUTPUT_FILE" ]; then
+    showUsage
+    exit 1
+  fi
+elif [ ! -f "$JOB_LIST_FILE" ]; then
+  echo "Job list $JOB_LIST_FILE does not exist"
   exit 1
 fi
 
@@ -92,24 +136,103 @@ IBL_DIR=$FILAMENT_DIR/ibl/tmp
 ASSETS_DIR=$MODEL_VIEWER_CHECKOUT_DIRECTORY/examples/assets
 GLTF_RENDERER_BIN=$FILAMENT_DIR/out/cmake-release/samples/gltf_renderer
 CMGEN_BIN=$FILAMENT_DIR/out/cmake-release/tools/cmgen/cmgen
+IBL_PACKER_BIN=$FILAMENT_DIR/out/cmake-release/samples/ibl_packer
 
-IBL_FILENAME=${IBL_INPUT_FILE##*/}
-IBL_BASENAME=${IBL_FILENAME%.*}
-IBL_OUTPUT_PATH=$IBL_DIR/$IBL_BASENAME
+# Settings passed to cmgen in addition to the deploy option. They are part of
+# the IBL cache key, so changing them invalidates previously generated IBLs.
+CMGEN_FLAGS=()
 
 if [ ! -d $IBL_DIR ]; then
   mkdir -p $IBL_DIR
 fi
 
-if [ "$REGENERATE_IBL" = true ] || [ ! -d $IBL_OUTPUT_PATH ]; then
-  $CMGEN_BIN -x $IBL_DIR $IBL_INPUT_FILE
-fi
+hashStdin() {
+  if command -v sha256sum > /dev/null; then
+    sha256sum | cut -d ' ' -f 1
+  else
+    shasum -a 256 | cut -d ' ' -f 1
+  fi
+}
 
-if [ -f $SCREENSHOT_OUTPUT_FILE ]; then
-  rm $SCREENSHOT_OUTPUT_FILE
-fi
+# Every IBL is cached under a hash of the environment map, the cmgen binary
+# and the cmgen settings, so identically named inputs never collide and any
+# change to them produces a new IBL.
+iblCacheKey() {
+  {
+    hashStdin < "$1"
+    hashStdin < "$CMGEN_BIN"
+    echo "${CMGEN_FLAGS[*]}"
+    hashStdin < "$IBL_PACKER_BIN"
+  } | hashStdin
+}
+
+# Generates the IBL for the given input file with cmgen if necessary, packs it
+# into a single file with ibl_packer, and stores the path to the pack in
+# IBL_OUTPUT_PATH. Several renders may share the IBL cache at once, so
+# generation happens under a per-IBL lock and the pack is moved into place only
+# once it has been written completely.
+prepareIBL() {
+  local IBL_FILENAME=${1##*/}
+  local IBL_BASENAME=${IBL_FILENAME%.*}
+  local IBL_KEY=`iblCacheKey "$1"`
+  local IBL_LOCK_FILE=$IBL_DIR/.$IBL_KEY.lock
+  IBL_OUTPUT_PATH=$IBL_DIR/$IBL_KEY.ibl
+
+  (
+    if command -v flock > /dev/null; then
+      flock 9
+    fi
+
+    if [ "$REGENERATE_IBL" = true ] || [ ! -f $IBL_OUTPUT_PATH ]; then
+      local IBL_STAGING_DIR=`mktemp -d "$IBL_DIR/.$IBL_KEY.XXXXXX"`
+      $CMGEN_BIN "${CMGEN_FLAGS[@]}" -x "$IBL_STAGING_DIR" "$1"
+      $IBL_PACKER_BIN "$IBL_STAGING_DIR/$IBL_BASENAME" \
+          "$IBL_STAGING_DIR/$IBL_KEY.ibl"
+      mv "$IBL_STAGING_DIR/$IBL_KEY.ibl" "$IBL_OUTPUT_PATH"
+      rm -rf "$IBL_STAGING_DIR"
+    fi
+  ) 9> "$IBL_LOCK_FILE"
+}
+
+if [ -n "$JOB_LIST_FILE" ]; then
+  MANIFEST_FILE=`mktemp`
+  trap "rm -f $MANIFEST_FILE" EXIT
+
+  # Every distinct IBL only needs to be (re)generated once per batch
+  PREPARED_IBLS=$'\n'
+
+  while IFS=$'\t' read -r JOB_WIDTH JOB_HEIGHT JOB_IBL JOB_OUTPUT JOB_MODEL \
+      || [ -n "$JOB_MODEL" ]; do
+    if [ -z "$JOB_MODEL" ]; then
+      continue
+    fi
 
-"$GLTF_RENDERER_BIN" -i "$IBL_OUTPUT_PATH" -w $RENDER_WIDTH -h $RENDER_HEIGHT -o "$SCREENSHOT_OUTPUT_FILE" "$MODEL_PATH"
+    PREVIOUS_REGENERATE_IBL=$REGENERATE_IBL
+    if [[ "$PREPARED_IBLS" == *$'\n'"$JOB_IBL"$'\n'* ]]; then
+      REGENERATE_IBL=false
+    fi
+    prepareIBL "$JOB_IBL"
+    REGENERATE_IBL=$PREVIOUS_REGENERATE_IBL
+    PREPARED_IBLS="$PREPARED_IBLS$JOB_IBL"$'\n'
+
+    if [ "$COMPARE_TO_EXISTING" = false ] && [ -f "$JOB_OUTPUT" ]; then
+      rm "$JOB_OUTPUT"
+    fi
+
+    printf '%s\t%s\t%s\t%s\t%s\n' "$JOB_WIDTH" "$JOB_HEIGHT" \
+        "$IBL_OUTPUT_PATH" "$JOB_OUTPUT" "$JOB_MODEL" >> $MANIFEST_FILE
+  done < "$JOB_LIST_FILE"
+
+  "$GLTF_RENDERER_BIN" "${RENDERER_FLAGS[@]}" -m "$MANIFEST_FILE"
+else
+  prepareIBL "$IBL_INPUT_FILE"
+
+  if [ "$COMPARE_TO_EXISTING" = false ] && [ -f $SCREENSHOT_OUTPUT_FILE ]; then
+    rm $SCREENSHOT_OUTPUT_FILE
+  fi
+
+  "$GLTF_RENDERER_BIN" "${RENDERER_FLAGS[@]}" -i "$IBL_OUTPUT_PATH" -w $RENDER_WIDTH -h $RENDER_HEIGHT -o "$SCREENSHOT_OUTPUT_FILE" "$MODEL_PATH"
+fi
 
 set +e
 set +x
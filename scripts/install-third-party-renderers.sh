@@ -75,7 +75,7 @@ echo '✋ NOTE: If this fails, please refer to the Filament README to learn how
 FILAMENT_REPO="https://github.com/google/filament.git"
 FILAMENT_DIR=$RENDERER_BASE_PATH/filament
 FILAMENT_PATCH_PATH=$MODEL_VIEWER_CHECKOUT_DIRECTORY/src/test/fidelity/filament.patch
-GLTF_RENDERER_CPP_PATH=$MODEL_VIEWER_CHECKOUT_DIRECTORY/src/test/fidelity/gltf_renderer.cpp
+FIDELITY_SOURCES_PATH=$MODEL_VIEWER_CHECKOUT_DIRECTORY/src/test/fidelity
 
 if [ -d "$FILAMENT_DIR" ] && [ "$REBUILD_EVERYTHING" = true ]; then
   rm -rf $FILAMENT_DIR
@@ -91,7 +91,8 @@ git fetch --depth=1 origin
 git reset --hard origin/master
 
 git apply $FILAMENT_PATCH_PATH
-cp $GLTF_RENDERER_CPP_PATH $FILAMENT_DIR/samples
+# gltf_renderer, image_comparator and the headers they share
+cp $FIDELITY_SOURCES_PATH/*.cpp $FIDELITY_SOURCES_PATH/*.h $FILAMENT_DIR/samples
 
 # Export critical environment variables for building Filament
 export CXXFLAGS=-stdlib=libc++
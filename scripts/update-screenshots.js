@@ -13,9 +13,14 @@
  * limitations under the License.
  */
 
-const fs = require('fs').promises;
 const {spawn} = require('child_process');
 const path = require('path');
+const {
+  fidelityTestDirectory,
+  parseRenderFarmArguments,
+  readScenarioSources,
+  renderFilamentScreenshots
+} = require('./filament-render-farm.js');
 
 const warn = (message) => console.warn(`🚨 ${message}`);
 const exit = (code = 0) => {
@@ -23,20 +28,13 @@ const exit = (code = 0) => {
   process.exit(code);
 };
 
-const fidelityTestDirectory = path.resolve('./test/fidelity');
-const filamentScreenshotScript =
-    path.resolve('./scripts/filament-screenshot.sh');
-const backgroundImageRe = /background-image\="([^"]+)"/;
-const modelSourceRe = /src\="([^"]+)"/
+const {options: renderFarmOptions, remainingArgs} =
+    parseRenderFarmArguments(process.argv.slice(2));
 
 let rendererWhitelist = null;
 
-if (process.argv.length > 2) {
-  rendererWhitelist = new Set();
-
-  for (let i = 2; i < process.argv.length; i++) {
-    rendererWhitelist.add(process.argv[i]);
-  }
+if (remainingArgs.length > 0) {
+  rendererWhitelist = new Set(remainingArgs);
 }
 
 const run = async (command, args) => new Promise((resolve, reject) => {
@@ -61,22 +59,14 @@ const run = async (command, args) => new Promise((resolve, reject) => {
 
 const updateScreenshots = async (config) => {
   const {scenarios} = config;
+  const filamentJobs = [];
 
   console.log(`🆙 Updating screenshots`);
 
   for (const scenario of scenarios) {
     const {goldens, slug} = scenario;
-    const scenarioDirectory = path.join(fidelityTestDirectory, slug);
-    const testHtmlPath = path.join(scenarioDirectory, 'index.html');
-
-    const html = (await fs.readFile(testHtmlPath)).toString();
-
-    const backgroundImageMatch = html.match(backgroundImageRe);
-    const backgroundImage =
-        backgroundImageMatch != null ? backgroundImageMatch[1] : null;
-
-    const modelSourceMatch = html.match(modelSourceRe);
-    const modelSource = modelSourceMatch != null ? modelSourceMatch[1] : null;
+    const {scenarioDirectory, backgroundImagePath, modelSourcePath} =
+        await readScenarioSources(slug);
 
     for (const golden of goldens) {
       const {name, file} = golden;
@@ -108,65 +98,33 @@ const updateScreenshots = async (config) => {
         case 'Filament':
           const {width, height} = scenario.dimensions;
 
-          if (modelSource == null) {
+          if (modelSourcePath == null) {
             warn(`Could not determine model source for ${
                 scenario.slug}; skipping...`);
             continue;
           }
 
-          if (backgroundImage == null) {
+          if (backgroundImagePath == null) {
             warn(`Could not determine IBL for ${scenario.slug}; skipping...`);
             continue;
           }
 
-          const backgroundImagePath =
-              path.resolve(path.dirname(testHtmlPath), backgroundImage);
-
-          const modelSourcePath =
-              path.resolve(path.dirname(testHtmlPath), modelSource);
-
-          await new Promise((resolve, reject) => {
-            console.log(`🖌️  Rendering ${name} screenshot for ${slug}...`);
-
-            const childProcess = spawn(
-                filamentScreenshotScript,
-                [
-                  '-w',
-                  `${width}`,
-                  '-h',
-                  `${height}`,
-                  '-i',
-                  backgroundImagePath,
-                  '-m',
-                  modelSourcePath,
-                  '-o',
-                  filePath
-                ],
-                {
-                  cwd: process.cwd(),
-                  env: process.env,
-                  stdio: ['ignore', 'inherit', 'inherit']
-                });
-
-            childProcess.once('error', (error) => {
-              warn(error);
-            });
-
-            childProcess.once('exit', (code) => {
-              if (code === 0) {
-                console.log(
-                    `✅ Successfully captured screenshot for ${name} ${slug}`);
-                resolve();
-              } else {
-                reject(new Error('Failed to capture Filament screenshot'));
-              }
-            });
+          filamentJobs.push({
+            name,
+            slug,
+            width,
+            height,
+            backgroundImagePath,
+            modelSourcePath,
+            filePath
           });
 
           break;
       }
     }
   }
+
+  await renderFilamentScreenshots(filamentJobs, renderFarmOptions);
 };
 
 updateScreenshots(require(path.join(fidelityTestDirectory, 'config.json')))
@@ -14,6 +14,7 @@
  */
 
 const {promises: fs} = require('fs');
+const {spawn} = require('child_process');
 const puppeteer = require('puppeteer');
 const path = require('path');
 const {PNG} = require('pngjs');
@@ -24,6 +25,14 @@ import ModelViewerElementBase from '../../model-viewer-base.js';
 
 const DEVICE_PIXEL_RATIO = 2;
 
+// The native image_comparator is built alongside gltf_renderer by
+// scripts/install-third-party-renderers.sh. When it is available it is used
+// in place of the JavaScript ImageComparator, analyzing all thresholds in one
+// pass.
+const NATIVE_IMAGE_COMPARATOR_PATH = process.env.IMAGE_COMPARATOR_BIN ||
+    path.resolve(
+        './renderers/filament/out/cmake-release/samples/image_comparator');
+
 export type AnalysisResults = Array<Array<ImageComparisonAnalysis>>;
 
 export interface ScenarioRecord extends ScenarioConfig {
@@ -91,19 +100,25 @@ export class ArtifactCreator {
       const golden = await fs.readFile(
           path.join(this.config.scenarioDirectory, slug, goldenConfig.file));
 
-      const screenshotImage = PNG.sync.read(screenshot).data;
-      const goldenImage = PNG.sync.read(golden).data;
-
-      const comparator =
-          new ImageComparator(screenshotImage, goldenImage, dimensions);
-
       await fs.writeFile(
           path.join(this.config.outputDirectory, slug, goldenConfig.file),
           golden);
 
-      for (const threshold of analysisThresholds) {
+      const screenshotPath =
+          path.join(this.config.outputDirectory, slug, 'model-viewer.png');
+      const goldenPath =
+          path.join(this.config.scenarioDirectory, slug, goldenConfig.file);
+
+      const analyses = await this.analyzeNatively(
+                           screenshotPath, goldenPath, analysisThresholds) ||
+          this.analyzeInScript(
+              screenshot, golden, dimensions, analysisThresholds);
+
+      for (let i = 0; i < analysisThresholds.length; ++i) {
+        const threshold = analysisThresholds[i];
+        const analysis = analyses[i];
+
         console.log(`\n  📏 Using threshold ${threshold.toFixed(1)}`);
-        const {analysis} = comparator.analyze(threshold);
         const {
           matchingRatio,
           averageDistanceRatio,
@@ -126,6 +141,84 @@ export class ArtifactCreator {
     return analysisResults;
   }
 
+  protected analyzeInScript(
+      screenshot: Buffer, golden: Buffer, dimensions: Dimensions,
+      analysisThresholds: Array<number>): Array<ImageComparisonAnalysis> {
+    const screenshotImage = PNG.sync.read(screenshot).data;
+    const goldenImage = PNG.sync.read(golden).data;
+
+    const comparator =
+        new ImageComparator(screenshotImage, goldenImage, dimensions);
+
+    return analysisThresholds.map(
+        threshold =>
+            comparator.analyze(threshold, {generateVisuals: false}).analysis);
+  }
+
+  /**
+   * Runs the native image_comparator on the given images, resolving with one
+   * analysis per threshold, or null if the native comparator is unavailable
+   * or fails, in which case the images are compared in script instead.
+   */
+  protected async analyzeNatively(
+      candidatePath: string, goldenPath: string,
+      analysisThresholds: Array<number>):
+      Promise<Array<ImageComparisonAnalysis>|null> {
+    try {
+      await fs.access(NATIVE_IMAGE_COMPARATOR_PATH);
+    } catch (error) {
+      return null;
+    }
+
+    try {
+      return await this.runNativeComparator(
+          candidatePath, goldenPath, analysisThresholds);
+    } catch (error) {
+      console.log(`🚨 ${error}, falling back to the script comparator`);
+      return null;
+    }
+  }
+
+  protected runNativeComparator(
+      candidatePath: string, goldenPath: string,
+      analysisThresholds: Array<number>):
+      Promise<Array<ImageComparisonAnalysis>> {
+    return new Promise<Array<ImageComparisonAnalysis>>((resolve, reject) => {
+      const childProcess = spawn(
+          NATIVE_IMAGE_COMPARATOR_PATH,
+          [
+            `--thresholds=${analysisThresholds.join(',')}`,
+            candidatePath,
+            goldenPath
+          ],
+          {stdio: ['ignore', 'pipe', 'inherit']});
+      let output = '';
+
+      childProcess.stdout.on('data', (data: Buffer) => {
+        output += data.toString();
+      });
+
+      childProcess.once('error', reject);
+
+      childProcess.once('exit', (code: number) => {
+        if (code !== 0) {
+          reject(new Error(`Native image comparison failed (code ${code})`));
+          return;
+        }
+
+        try {
+          const analyses = JSON.parse(output);
+          if (!Array.isArray(analyses) ||
+              analyses.length !== analysisThresholds.length) {
+            throw new Error('unexpected output');
+          }
+          resolve(analyses);
+        } catch (error) {
+          reject(new Error(`Native image comparison failed (${error})`));
+        }
+      });
+    });
+  }
 
   async captureScreenshot(
       slug: string, dimensions: Dimensions,
@@ -0,0 +1,58 @@
+/*
+ * Copyright 2019 Google Inc. All Rights Reserved.
+ * Licensed under the Apache License, Version 2.0 (the 'License');
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an 'AS IS' BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+import {COMPONENTS_PER_PIXEL, ImageComparator} from './common.js';
+
+const expect = chai.expect;
+
+const DIMENSIONS = {width: 7, height: 5};
+
+const makeImage = (): Uint8ClampedArray => {
+  const image = new Uint8ClampedArray(
+      DIMENSIONS.width * DIMENSIONS.height * COMPONENTS_PER_PIXEL);
+
+  for (let i = 0; i < image.length; ++i) {
+    image[i] = (i * 13) % 256;
+  }
+
+  return image;
+};
+
+suite('ImageComparator', () => {
+  suite('analyze', () => {
+    test('matches identical images at a threshold of 0', () => {
+      const image = makeImage();
+      const comparator = new ImageComparator(image, image, DIMENSIONS);
+
+      const {analysis} = comparator.analyze(0, {generateVisuals: false});
+
+      expect(analysis.matchingRatio).to.be.equal(1);
+      expect(analysis.averageDistanceRatio).to.be.equal(0);
+    });
+
+    test('does not match a changed pixel at a threshold of 0', () => {
+      const candidate = makeImage();
+      const golden = makeImage();
+      golden[0] = 255 - golden[0];
+
+      const comparator = new ImageComparator(candidate, golden, DIMENSIONS);
+
+      const {analysis} = comparator.analyze(0, {generateVisuals: false});
+
+      expect(analysis.matchingRatio)
+          .to.be.equal(1 - 1 / (DIMENSIONS.width * DIMENSIONS.height));
+    });
+  });
+});
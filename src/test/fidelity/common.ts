@@ -155,7 +155,9 @@ export class ImageComparator {
         const position = index * COMPONENTS_PER_PIXEL;
         const delta =
             colorDelta(candidateImage, goldenImage, position, position);
-        const exactlyMatched = (delta < thresholdSquared ? 1 : 0) * 255;
+        // Identical pixels match even at a threshold of 0
+        const exactlyMatched =
+            (delta === 0 || delta < thresholdSquared ? 1 : 0) * 255;
 
         if (exactlyMatched) {
           matched++;
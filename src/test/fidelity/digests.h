@@ -0,0 +1,184 @@
+/*
+ * Copyright 2019 Google Inc. All Rights Reserved.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MODEL_VIEWER_FIDELITY_DIGESTS_H
+#define MODEL_VIEWER_FIDELITY_DIGESTS_H
+
+// The digest manifest of gltf_renderer --digests, which remembers for every
+// output a digest of the inputs it was rendered from and of the pixels that
+// were written to it. One tab-separated line per output:
+//
+//   <output> <input digest> <pixel digest>
+//
+// Digests are 64-bit FNV-1a hashes in 16 hex digits.
+
+#include "mapped_file.h"
+
+#include <dirent.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace fidelity {
+
+constexpr uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ull;
+constexpr uint64_t FNV_PRIME = 0x100000001b3ull;
+
+// 64-bit FNV-1a, which may be chained by passing the previous hash
+inline uint64_t hashBytes(
+    const uint8_t* data, size_t size, uint64_t hash = FNV_OFFSET_BASIS) {
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ data[i]) * FNV_PRIME;
+  }
+  return hash;
+}
+
+struct DigestRecord {
+  std::string inputs;
+  std::string pixels;
+};
+
+// Records by output path
+using DigestManifest = std::map<std::string, DigestRecord>;
+
+inline std::string hexDigest(uint64_t hash) {
+  char digits[17];
+  snprintf(digits, sizeof(digits), "%016llx", (unsigned long long)hash);
+  return digits;
+}
+
+inline uint64_t hashString(const std::string& value, uint64_t hash) {
+  // The terminator separates consecutive strings
+  return hashBytes(
+      reinterpret_cast<const uint8_t*>(value.c_str()), value.size() + 1, hash);
+}
+
+// Hashes the contents of a file, or of every file directly within a
+// directory in name order, along with their names. Returns false if
+// something cannot be read.
+inline bool hashPath(const std::string& path, uint64_t* hash) {
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0) {
+    return false;
+  }
+
+  std::vector<std::string> files;
+  if (S_ISDIR(info.st_mode)) {
+    DIR* directory = opendir(path.c_str());
+    if (directory == nullptr) {
+      return false;
+    }
+    while (struct dirent* entry = readdir(directory)) {
+      std::string file = path + "/" + entry->d_name;
+      if (stat(file.c_str(), &info) == 0 && S_ISREG(info.st_mode)) {
+        files.push_back(file);
+      }
+    }
+    closedir(directory);
+    std::sort(files.begin(), files.end());
+  } else {
+    files.push_back(path);
+  }
+
+  for (auto& file : files) {
+    *hash = hashString(file.substr(file.find_last_of('/') + 1), *hash);
+
+    // Empty files cannot be mapped, and do not add anything to the hash
+    MappedFile mapping;
+    if (stat(file.c_str(), &info) != 0 ||
+        (info.st_size > 0 && !mapping.open(file))) {
+      return false;
+    }
+    *hash = hashBytes(mapping.data(), mapping.size(), *hash);
+  }
+  return true;
+}
+
+// The URIs of the external buffers and images that a glTF file refers to.
+// Only needs to be good enough for hashing, so the JSON is not parsed.
+inline std::vector<std::string> externalUris(
+    const uint8_t* json, size_t size) {
+  std::vector<std::string> uris;
+  const std::string text(reinterpret_cast<const char*>(json), size);
+  const std::string key = "\"uri\"";
+  for (size_t at = text.find(key); at != std::string::npos;
+       at = text.find(key, at + key.size())) {
+    size_t begin = text.find('"', text.find(':', at + key.size()));
+    size_t end = text.find('"', begin + 1);
+    if (begin == std::string::npos || end == std::string::npos) {
+      break;
+    }
+    std::string uri = text.substr(begin + 1, end - begin - 1);
+    if (uri.compare(0, 5, "data:") != 0) {
+      uris.push_back(uri);
+    }
+  }
+  return uris;
+}
+
+// A missing manifest is an empty one
+inline bool readDigests(const std::string& path, DigestManifest* manifest) {
+  std::ifstream in(path);
+  if (!in) {
+    return true;
+  }
+
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    std::string output;
+    DigestRecord record;
+    if (!std::getline(fields, output, '\t') ||
+        !std::getline(fields, record.inputs, '\t') ||
+        !std::getline(fields, record.pixels)) {
+      return false;
+    }
+    (*manifest)[output] = record;
+  }
+  return true;
+}
+
+// Writes the manifest under a temporary name first, so that an interrupted
+// run leaves the previous manifest in place
+inline bool writeDigests(
+    const std::string& path, const DigestManifest& manifest) {
+  std::string temporaryPath = path + "." + std::to_string(getpid());
+  {
+    std::ofstream out(temporaryPath, std::ios::trunc);
+    for (auto& item : manifest) {
+      out << item.first << "\t" << item.second.inputs << "\t"
+          << item.second.pixels << "\n";
+    }
+    if (!out) {
+      remove(temporaryPath.c_str());
+      return false;
+    }
+  }
+
+  return rename(temporaryPath.c_str(), path.c_str()) == 0;
+}
+
+}  // namespace fidelity
+
+#endif  // MODEL_VIEWER_FIDELITY_DIGESTS_H
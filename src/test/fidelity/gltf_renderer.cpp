@@ -18,18 +18,40 @@
 #include "app/FilamentApp.h"
 #include "app/MeshAssimp.h"
 
+#include "digests.h"
+#include "ibl_pack.h"
+#include "image_comparator.h"
+#include "image_io.h"
+#include "mapped_file.h"
+#include "pixel_conversion.h"
+#include "readback.h"
+#include "render_server.h"
+#include "resource_budget.h"
+#include "stats.h"
+#include "task_pool.h"
+#include "tiling.h"
+
 #include <filament/Engine.h>
+#include <filament/Fence.h>
 #include <filament/IndirectLight.h>
 #include <filament/LightManager.h>
 #include <filament/Material.h>
 #include <filament/MaterialInstance.h>
 #include <filament/RenderableManager.h>
 #include <filament/Scene.h>
+#include <filament/Skybox.h>
 #include <filament/Texture.h>
 #include <filament/TransformManager.h>
 #include <filament/View.h>
 #include <filament/driver/PixelBufferDescriptor.h>
 
+#include "app/IBL.h"
+
+#include <gltfio/Animator.h>
+#include <gltfio/AssetLoader.h>
+#include <gltfio/FilamentAsset.h>
+#include <gltfio/ResourceLoader.h>
+
 #include <utils/EntityManager.h>
 #include <utils/Path.h>
 
@@ -46,9 +68,21 @@
 #include <stdlib.h>
 
 #include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <fstream>
+#include <future>
+#include <iostream>
+#include <limits>
+#include <list>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -57,20 +91,329 @@ using namespace filament;
 using namespace filamat;
 using namespace utils;
 using namespace image;
+using namespace gltfio;
+
+// Capture starts once the GPU has caught up with the uploads issued during
+// setup and two consecutive frames are identical. These bound how long we
+// wait for that to happen; the minimum accounts for the back buffer.
+const int MIN_WARMUP_FRAMES = 1;
+const int MAX_WARMUP_FRAMES = 10;
+// Frames past the warm-up that a job waits for the window to take its size
+const int MAX_RESIZE_FRAMES = 10;
+
+// Trade-offs between the cost and the fidelity of a render, chosen with
+// --profile. The golden profile renders what the fidelity tests compare
+// against; the preview profile is meant for smoke renders that only need to
+// show that a scenario loads and looks roughly right.
+struct QualityProfile {
+  const char* name;
+  bool shadows;
+  bool postProcessing;
+  // MSAA samples, or 0 to keep those FilamentApp configured
+  uint8_t sampleCount;
+  int maxWarmupFrames;
+  // Whether glTF materials come from precompiled ubershaders
+  bool ubershaders;
+};
+
+const QualityProfile QUALITY_PROFILES[] = {
+    {"golden", true, true, 0, MAX_WARMUP_FRAMES, false},
+    {"preview", false, false, 1, MIN_WARMUP_FRAMES + 2, true},
+};
+
+// The Filament backends that --backend selects from. Captures are read back
+// with Renderer::readPixels and a fence, which every backend implements, so
+// the render loop does not depend on the backend.
+struct BackendOption {
+  const char* name;
+  Engine::Backend backend;
+};
+
+const BackendOption BACKENDS[] = {
+    {"opengl", Engine::Backend::OPENGL},
+    {"vulkan", Engine::Backend::VULKAN},
+    {"metal", Engine::Backend::METAL},
+};
+
+const float FRAMED_HEIGHT = 10.0f;
+const float ROOM_PADDING_SCALE = 1.01f;
+const float FOV = 45.0f;
 
-const int FRAME_TO_SKIP = 10;
+// A single screenshot to be produced. When running from a manifest, many jobs
+// are rendered one after another by the same Engine so that only the
+// per-model state has to be recreated between them. Consecutive jobs of the
+// same model (e.g. the views of a turntable) share a single load of it.
+struct RenderJob {
+  int width = 768;
+  int height = 768;
+  std::string iblDirectory;
+  std::string outputPath;
+  std::string goldenPath;
+  std::vector<Path> filenames;
+  // Orbit of the camera around the center of the room, in degrees. Positive
+  // pitch looks down on the model.
+  float yaw = 0.0f;
+  float pitch = 0.0f;
+  // Vertical field of view, in degrees
+  float fov = FOV;
+  // The model is posed at this time of the animation with the given index,
+  // in seconds, unless it is negative. Jobs with several frames are expanded
+  // by expandSequences into one job per frame.
+  int animation = 0;
+  float animationTime = -1.0f;
+  int frames = 1;
+  // Set for jobs received with --listen; the response is written to it once
+  // the capture has been encoded
+  std::shared_ptr<fidelity::Connection> connection;
+  // Digest of everything the capture depends on, with --digests
+  std::string inputDigest;
+};
+
+// The output of a job received with --listen that returns the PNG in the
+// response instead of writing it to a file
+const char* const RESPONSE_OUTPUT = "-";
+
+// How long an idle render loop waits for a request before rendering a frame
+const std::chrono::milliseconds REQUEST_POLL_INTERVAL(10);
+
+// Per-stage timings of a job in milliseconds, written out by --stats. Only
+// compare, encode and peakResidentBytes are filled in off the render thread.
+struct JobStats {
+  double iblLoad = 0.0;
+  double modelLoad = 0.0;
+  double textureDecode = 0.0;
+  double warmup = 0.0;
+  int warmupFrames = 0;
+  double averageFrame = 0.0;
+  double readback = 0.0;
+  double compare = 0.0;
+  double encode = 0.0;
+  size_t peakResidentBytes = 0;
+};
+
+using RenderJobs = std::deque<RenderJob>;
+
+// Jobs keep the index they were given when they were added. With --listen,
+// the jobs that have been reported are dropped from the front as requests
+// come in, so that the daemon does not grow with every request. Other threads
+// look jobs up under g_jobsMutex; only the render thread adds and drops them,
+// which leaves the jobs that are still referred to where they are.
+static RenderJobs g_jobs;
+static std::deque<JobStats> g_stats;
+static size_t g_firstJob = 0;
+static std::mutex g_jobsMutex;
+static size_t g_currentJob = 0;
+// Jobs reported by g_encoder, which reports them in order
+static std::atomic<size_t> g_reportedJobs{0};
+
+static std::string g_statsPath;
+static fidelity::Clock::time_point g_startTime;
+static double g_engineInit = 0.0;
+
+static RenderJob& jobAt(size_t index) {
+  std::lock_guard<std::mutex> lock(g_jobsMutex);
+  return g_jobs[index - g_firstJob];
+}
+
+static JobStats& statsAt(size_t index) {
+  std::lock_guard<std::mutex> lock(g_jobsMutex);
+  return g_stats[index - g_firstJob];
+}
+
+// Jobs added so far, including those that have been dropped
+static size_t jobCount() {
+  return g_firstJob + g_jobs.size();
+}
+
+// The golden of a job, decoded on g_tasks while the job renders. A comparison
+// that gets to it before that task has started decodes it itself, as a task
+// must never wait for another that the pool may not have started.
+class GoldenImage {
+ public:
+  explicit GoldenImage(const std::string& path) : mPath(path) {}
+
+  // nullptr if the golden could not be decoded
+  std::shared_ptr<fidelity::DecodedImage> get() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mDecoded) {
+      mDecoded = true;
+      auto image = std::make_shared<fidelity::DecodedImage>();
+      if (Path(mPath).exists() && fidelity::decodeImage(mPath, image.get())) {
+        mImage = image;
+      }
+    }
+    return mImage;
+  }
 
-static std::vector<Path> g_filenames;
+ private:
+  const std::string mPath;
+  std::mutex mMutex;
+  bool mDecoded = false;
+  std::shared_ptr<fidelity::DecodedImage> mImage;
+};
+
+// How far the render loop has got with the current job. startJob starts
+// every job with a fresh context.
+struct JobContext {
+  bool texturesLoaded = false;
+  fidelity::Clock::time_point texturesStart;
+  fidelity::Clock::time_point warmupStart;
+  fidelity::Clock::time_point lastFrame;
+  double frameTimeTotal = 0.0;
+  int frameCount = 0;
+  // Whether the GPU has caught up with the uploads of the job
+  bool resourcesReady = false;
+  int currentFrame = 0;
+  uint32_t currentTile = 0;
+  // Why the model of the job could not be loaded, if it could not
+  std::string error;
+  // Only set when comparing
+  std::shared_ptr<GoldenImage> golden;
+};
+
+static JobContext g_job;
+
+// Runs the work of jobs that does not need the render thread: shrinking
+// images, and comparing, encoding and writing captures
+static size_t g_threadCount = 0;
+static std::unique_ptr<fidelity::TaskPool> g_tasks;
+
+// Enough for the captures in flight, queued for encoding and being assembled
+const size_t MAX_RETAINED_STAGING_BUFFERS = 16;
+
+static fidelity::StagingBufferPool g_stagingBuffers(
+    MAX_RETAINED_STAGING_BUFFERS);
 
-static std::map<std::string, MaterialInstance*> g_materialInstances;
-static std::unique_ptr<MeshAssimp> g_meshSet;
 static const Material* g_material;
+
+// glTF and GLB files are loaded with gltfio unless --assimp is passed; the
+// material provider and loader are shared by every job, so that each material
+// is only built once per process. Generated materials are compiled from
+// scratch on first use, whereas ubershaders are loaded precompiled.
+static bool g_forceAssimp = false;
+static bool g_ubershaders = false;
+static MaterialProvider* g_materialProvider = nullptr;
+static AssetLoader* g_assetLoader = nullptr;
 static Entity g_light;
 
-static bool g_rendered = false;
-static int g_currentFrame = 0;
+// A loaded model and everything that belongs to it, regardless of the loader
+// that created it
+struct LoadedModel {
+  // Absolute paths of the files the model was loaded from
+  std::vector<std::string> paths;
+  float3 minBound = float3(std::numeric_limits<float>::max());
+  float3 maxBound = float3(std::numeric_limits<float>::lowest());
+  // Entities whose transform places the model in the room
+  std::vector<Entity> roots;
+  std::vector<Entity> entities;
+
+  std::vector<FilamentAsset*> assets;
+  // Decode the textures of the assets on the JobSystem while frames are
+  // rendered
+  std::vector<std::unique_ptr<ResourceLoader>> resourceLoaders;
+  std::vector<std::shared_ptr<fidelity::MappedFile>> mappings;
+  std::map<std::string, MaterialInstance*> materialInstances;
+  std::unique_ptr<MeshAssimp> meshSet;
+  // Whether an animation has moved the model out of its rest pose
+  bool posed = false;
+};
+
+// An IBL loaded from a pack written by ibl_packer rather than from a cmgen
+// directory. Faces are uploaded straight out of the memory-mapped pack, which
+// stays mapped until the last of those uploads has been consumed.
+struct PackedIBL {
+  Engine* engine = nullptr;
+  Texture* reflections = nullptr;
+  Texture* skyboxTexture = nullptr;
+  IndirectLight* indirectLight = nullptr;
+  Skybox* skybox = nullptr;
+
+  ~PackedIBL() {
+    engine->destroy(indirectLight);
+    engine->destroy(skybox);
+    engine->destroy(reflections);
+    engine->destroy(skyboxTexture);
+  }
+};
+
+// Matches IBL_INTENSITY in samples/app/IBL.cpp
+const float PACKED_IBL_INTENSITY = 30000.0f;
+
+// The IBL of a job, whichever way it was loaded
+struct LoadedIBL {
+  std::string path;
+  std::unique_ptr<IBL> ibl;
+  std::unique_ptr<PackedIBL> packedIBL;
+  IndirectLight* indirectLight = nullptr;
+  Skybox* skybox = nullptr;
+};
+
+// Up to g_cacheSize of the most recently used models and IBLs stay loaded,
+// most recently used first, so that later jobs can use them again.
+static size_t g_cacheSize = 1;
+static std::list<std::unique_ptr<LoadedModel>> g_models;
+static std::list<std::unique_ptr<LoadedIBL>> g_ibls;
+// The model of the current job, which is the only one in the scene
+static LoadedModel* g_model = nullptr;
+// Models that have been evicted but not destroyed yet. They are out of the
+// scene, and postRender destroys one per frame so that evicting a model does
+// not hold up the start of the next job.
+static std::list<std::unique_ptr<LoadedModel>> g_retiredModels;
+
+static SDL_Window* g_window = nullptr;
+static float g_renderScale = 1.0f;
+
+// Zero until --max-warmup-frames or the quality profile sets it
+static int g_maxWarmupFrames = 0;
+static const QualityProfile* g_profile = &QUALITY_PROFILES[0];
+
+static uint32_t g_supersampling = 1;
+static uint32_t g_maxTileSize = 0;
+
+// Images with a longer side are shrunk before they are decoded into textures
+static uint32_t g_maxTextureSize = 0;
+// Jobs whose model is estimated to need more GPU memory are skipped
+static size_t g_memoryBudget = 0;
 
 static Config g_config;
+static std::string g_manifestPath;
+static std::vector<std::string> g_views;
+static std::string g_listenPath;
+static fidelity::RenderServer g_server;
+static bool g_flipY = false;
+static bool g_floatReadback = false;
+static fidelity::PNGOptions g_pngOptions;
+
+// Renders without dithering noise or a running clock, so that the same inputs
+// always produce the same pixels
+static bool g_deterministic = false;
+// Animation frames per second of sequences
+static float g_frameRate = 30.0f;
+// Animation settings of the job given on the command line
+static int g_frames = 1;
+static int g_animation = 0;
+static float g_animationTime = -1.0f;
+static std::string g_digestsPath;
+// The manifest as it was read before the first job, and as it is updated by
+// g_encoder
+static fidelity::DigestManifest g_recordedDigests;
+static fidelity::DigestManifest g_digests;
+// Hash of the renderer binary, with which every input digest starts
+static uint64_t g_rendererDigest = fidelity::FNV_OFFSET_BASIS;
+
+static bool g_compare = false;
+static std::string g_goldenPath;
+static std::vector<double> g_thresholds = {0.0, 1.0, 10.0};
+static std::string g_resultsPath;
+static std::vector<std::string> g_results;
+// Jobs that could not be loaded or written, counted on g_encoder
+static size_t g_failedJobs = 0;
+
+// Encodes, compares and reports captures, and reports failed jobs, in the
+// order of the jobs. Bounds the captures waiting for it, e.g. the frames of a
+// sequence that are rendered faster than they can be written.
+const size_t MAX_QUEUED_ENCODES = 8;
+static fidelity::Worker g_encoder(MAX_QUEUED_ENCODES);
 
 static void printUsage(char* name) {
   std::string usage(
@@ -78,6 +421,8 @@ static void printUsage(char* name) {
       "renderer\n"
       "Usage:\n"
       "    gltf_viewer [options] <gltf/glb>\n"
+      "    gltf_viewer [options] --manifest=<path>\n"
+      "    gltf_viewer [options] --listen=<socket>\n"
       "Options:\n"
       "   --help, -?\n"
       "       Prints this message\n\n"
@@ -86,20 +431,169 @@ static void printUsage(char* name) {
       "   --height=<height>, -h <height>\n"
       "       Height of the render\n\n"
       "   --output=<path>, -o <path>\n"
-      "       Output path where a PNG of the render will be saved\n\n"
+      "       Output path where a PNG of the render will be saved. Outputs\n"
+      "       ending in .qoi or .ppm are written as QOI or binary PPM, which\n"
+      "       are much faster to encode, and other extensions known to\n"
+      "       Filament's ImageEncoder (e.g. .exr) in its formats\n\n"
+      "   --png-level=<0-9>, -z <level>\n"
+      "       zlib compression level of PNG outputs, from 0 (fastest) to 9\n"
+      "       (smallest)\n\n"
+      "   --png-filter=<filter>, -Z <filter>\n"
+      "       Row filter of PNG outputs: none, sub, up, avg, paeth or all\n\n"
       "   --ibl=<path to cmgen IBL>, -i <path>\n"
-      "       Applies an IBL generated by cmgen's deploy option\n\n");
+      "       Applies an IBL generated by cmgen's deploy option, or an IBL\n"
+      "       pack written by ibl_packer\n\n"
+      "   --max-warmup-frames=<count>, -f <count>\n"
+      "       Maximum number of frames to wait for the render to become\n"
+      "       stable before it is captured anyway (default: 10, or 3 with\n"
+      "       the preview profile)\n\n"
+      "   --profile=<golden|preview>, -P <profile>\n"
+      "       Selects the quality of the render. preview renders without\n"
+      "       shadows, MSAA or post-processing, uses ubershaders and waits\n"
+      "       for fewer warm-up frames (default: golden)\n\n"
+      "   --flip-y, -y\n"
+      "       Flips the captured image vertically before it is written\n\n"
+      "   --deterministic, -d\n"
+      "       Renders without temporal dithering and with a clock that\n"
+      "       never advances, so that the same inputs always produce the\n"
+      "       same pixels\n\n"
+      "   --digests=<path>, -D <path>\n"
+      "       Keeps a manifest of digests of the inputs of every output and\n"
+      "       of the pixels written to it. Jobs whose inputs (the renderer,\n"
+      "       model and IBL files, dimensions, camera and render settings)\n"
+      "       have not changed are skipped unless comparing, and outputs\n"
+      "       whose pixels have not changed are not written again. Implies\n"
+      "       --deterministic\n\n"
+      "   --float-readback, -F\n"
+      "       Reads the render back as floats, which formats other than PNG\n"
+      "       (e.g. EXR) are written from without quantizing them to 8 bits.\n"
+      "       Cannot be combined with --supersample or --tile-size\n\n"
+      "   --supersample=<factor>, -X <factor>\n"
+      "       Renders factor x factor samples for every output pixel and\n"
+      "       averages them\n\n"
+      "   --tile-size=<pixels>, -T <pixels>\n"
+      "       Renders the (supersampled) image in tiles no larger than the\n"
+      "       given size, which bounds the size of the window\n\n"
+      "   --max-texture-size=<pixels>, -x <pixels>\n"
+      "       Halves external images of glTF models until neither side is\n"
+      "       longer than the given size before they are decoded, which\n"
+      "       saves GPU memory and decoding time when rendering thumbnails\n\n"
+      "   --memory-budget=<MiB>, -g <MiB>\n"
+      "       Skips the jobs whose model is estimated to need more GPU\n"
+      "       memory than the budget for its buffers and (shrunk) textures,\n"
+      "       and reports its largest resources instead of rendering it\n\n"
+      "   --ubershaders, -U\n"
+      "       Renders glTF materials with gltfio's precompiled ubershaders\n"
+      "       instead of materials generated for each configuration, which\n"
+      "       saves compiling them but may not match the goldens exactly.\n"
+      "       Implied by the preview profile\n\n"
+      "   --assimp, -A\n"
+      "       Loads glTF and GLB files with Assimp instead of gltfio\n\n"
+      "   --headless, -H\n"
+      "       Renders into a hidden window whose drawable matches the\n"
+      "       requested dimensions exactly, ignoring display scaling\n\n"
+      "   --backend=<opengl|vulkan|metal>, -b <backend>\n"
+      "       Selects the Filament backend to render with (default:\n"
+      "       opengl). Metal is only available on macOS\n\n"
+      "   --compare[=<golden>], -c[<golden>]\n"
+      "       Compares the render to a golden image in memory. Without a\n"
+      "       golden, each render is compared to the existing file at its\n"
+      "       output path. The render is only written out when it does not\n"
+      "       match, i.e. when a pixel exceeds the largest threshold\n\n"
+      "   --thresholds=<list>, -t <list>\n"
+      "       Comma-separated thresholds to compare at (default: 0,1,10)\n\n"
+      "   --view=<output>[,<key>=<value>...], -V <view>\n"
+      "       Renders the model from another camera, or at another size,\n"
+      "       to the given output without loading it again. May be repeated,\n"
+      "       and replaces --output. The keys are yaw and pitch (orbit of the\n"
+      "       camera in degrees), fov (vertical field of view in degrees),\n"
+      "       width, height, and animation, time and frames (see below)\n\n"
+      "   --frames=<count>, -n <count>\n"
+      "       Renders a sequence of frames of the model's animation, stepped\n"
+      "       at the frame rate, to outputs numbered before the extension\n"
+      "       (e.g. out_0001.png). The model is only loaded once, and frames\n"
+      "       are read back and encoded while the next ones are rendered\n\n"
+      "   --frame-rate=<fps>, -R <fps>\n"
+      "       Frame rate of sequences (default: 30)\n\n"
+      "   --animation=<index>, -a <index>\n"
+      "       Animation of the model that sequences play (default: 0)\n\n"
+      "   --time=<seconds>, -e <seconds>\n"
+      "       Poses the model at the given time of its animation, or starts\n"
+      "       the sequence there. Animations shorter than that loop\n\n"
+      "   --results=<path>, -r <path>\n"
+      "       Writes the comparison results as JSON to a file instead of\n"
+      "       stdout\n\n"
+      "   --stats=<path>, -s <path>\n"
+      "       Writes the time spent in every stage of every job, and the\n"
+      "       peak resident memory, as JSON to a file\n\n"
+      "   --threads=<count>, -j <count>\n"
+      "       Number of threads that shrink images and compare, encode and\n"
+      "       write captures, several jobs at a time (default: one per\n"
+      "       core)\n\n"
+      "   --cache=<count>, -K <count>\n"
+      "       Number of the most recently used models and IBLs that stay\n"
+      "       loaded for later jobs (default: 1)\n\n"
+      "   --listen=<socket>, -L <socket>\n"
+      "       Once the jobs given on the command line are done, keeps\n"
+      "       running and renders the jobs that clients send to a Unix\n"
+      "       domain socket at the given path. Each line of a request is a\n"
+      "       job in the format of a manifest line, 'reset' to release\n"
+      "       every cached model and IBL, or 'quit' to exit. For each job,\n"
+      "       a JSON line with the output path, the number of bytes that\n"
+      "       follow it and, when comparing, whether it passed is sent\n"
+      "       back. The output '-' returns the PNG in those bytes\n"
+      "       instead of writing it. Rejected jobs get {\"error\":...}.\n"
+      "       Cannot be combined with --results or --stats\n\n"
+      "   --manifest=<path>, -m <path>\n"
+      "       Renders every job listed in a manifest using a single engine.\n"
+      "       Each line holds tab-separated fields:\n"
+      "           <width> <height> <ibl> <output> [<key>=<value>...]\n"
+      "           <gltf/glb>...\n"
+      "       where the optional settings are those of --view. Consecutive\n"
+      "       lines with the same models only load them once. Empty lines\n"
+      "       and lines starting with '#' are ignored. Use '-' to read the\n"
+      "       manifest from stdin\n\n");
   std::cout << usage;
 }
 
 static int handleCommandLineArgments(int argc, char* argv[], Config* config) {
-  static constexpr const char* OPTSTR = "?i:w:h:o:";
+  static constexpr const char* OPTSTR =
+      "?i:w:h:o:m:f:ydD:FHb:AUX:T:x:g:c::t:r:s:V:n:R:a:e:P:K:j:L:z:Z:";
   static const struct option OPTIONS[] = {
       {"help", no_argument, nullptr, '?'},
       {"ibl", required_argument, nullptr, 'i'},
       {"width", no_argument, nullptr, 'w'},
       {"height", no_argument, nullptr, 'h'},
       {"output", required_argument, nullptr, 'o'},
+      {"png-level", required_argument, nullptr, 'z'},
+      {"png-filter", required_argument, nullptr, 'Z'},
+      {"manifest", required_argument, nullptr, 'm'},
+      {"max-warmup-frames", required_argument, nullptr, 'f'},
+      {"flip-y", no_argument, nullptr, 'y'},
+      {"deterministic", no_argument, nullptr, 'd'},
+      {"digests", required_argument, nullptr, 'D'},
+      {"float-readback", no_argument, nullptr, 'F'},
+      {"headless", no_argument, nullptr, 'H'},
+      {"backend", required_argument, nullptr, 'b'},
+      {"assimp", no_argument, nullptr, 'A'},
+      {"ubershaders", no_argument, nullptr, 'U'},
+      {"supersample", required_argument, nullptr, 'X'},
+      {"tile-size", required_argument, nullptr, 'T'},
+      {"max-texture-size", required_argument, nullptr, 'x'},
+      {"memory-budget", required_argument, nullptr, 'g'},
+      {"compare", optional_argument, nullptr, 'c'},
+      {"thresholds", required_argument, nullptr, 't'},
+      {"results", required_argument, nullptr, 'r'},
+      {"stats", required_argument, nullptr, 's'},
+      {"view", required_argument, nullptr, 'V'},
+      {"frames", required_argument, nullptr, 'n'},
+      {"frame-rate", required_argument, nullptr, 'R'},
+      {"animation", required_argument, nullptr, 'a'},
+      {"time", required_argument, nullptr, 'e'},
+      {"profile", required_argument, nullptr, 'P'},
+      {"cache", required_argument, nullptr, 'K'},
+      {"threads", required_argument, nullptr, 'j'},
+      {"listen", required_argument, nullptr, 'L'},
       {0, 0, 0, 0}  // termination of the option list
   };
   int opt;
@@ -120,71 +614,838 @@ static int handleCommandLineArgments(int argc, char* argv[], Config* config) {
       case 'o':
         config->outputPath = arg;
         break;
+      case 'z':
+        g_pngOptions.compressionLevel =
+            std::min(std::max(std::stoi(arg), 0), 9);
+        break;
+      case 'Z':
+        if (!fidelity::parsePNGFilter(arg, &g_pngOptions.filters)) {
+          std::cerr << "unknown PNG filter " << arg << std::endl;
+          exit(1);
+        }
+        break;
       case 'i':
         config->iblDirectory = arg;
         break;
+      case 'm':
+        g_manifestPath = arg;
+        break;
+      case 'f':
+        g_maxWarmupFrames = std::max(std::stoi(arg), MIN_WARMUP_FRAMES + 1);
+        break;
+      case 'y':
+        g_flipY = true;
+        break;
+      case 'F':
+        g_floatReadback = true;
+        break;
+      case 'd':
+        g_deterministic = true;
+        break;
+      case 'D':
+        g_digestsPath = arg;
+        g_deterministic = true;
+        break;
+      case 'H':
+        config->headless = true;
+        break;
+      case 'A':
+        g_forceAssimp = true;
+        break;
+      case 'U':
+        g_ubershaders = true;
+        break;
+      case 'X':
+        g_supersampling = std::max(std::stoi(arg), 1);
+        break;
+      case 'T':
+        g_maxTileSize = std::max(std::stoi(arg), 0);
+        break;
+      case 'x':
+        g_maxTextureSize = std::max(std::stoi(arg), 0);
+        break;
+      case 'g':
+        g_memoryBudget = size_t(std::max(std::stod(arg), 0.0) * 1024 * 1024);
+        break;
+      case 'c':
+        g_compare = true;
+        g_goldenPath = arg;
+        break;
+      case 't':
+        g_thresholds = fidelity::parseThresholds(arg);
+        break;
+      case 'r':
+        g_resultsPath = arg;
+        break;
+      case 's':
+        g_statsPath = arg;
+        break;
+      case 'V':
+        g_views.push_back(arg);
+        break;
+      case 'n':
+        g_frames = std::max(std::stoi(arg), 1);
+        break;
+      case 'R':
+        g_frameRate = std::stof(arg);
+        if (g_frameRate <= 0.0f) {
+          std::cerr << "the frame rate must be positive" << std::endl;
+          exit(1);
+        }
+        break;
+      case 'a':
+        g_animation = std::max(std::stoi(arg), 0);
+        break;
+      case 'e':
+        g_animationTime = std::max(std::stof(arg), 0.0f);
+        break;
+      case 'K':
+        g_cacheSize = std::max(std::stoi(arg), 1);
+        break;
+      case 'j':
+        g_threadCount = std::max(std::stoi(arg), 1);
+        break;
+      case 'L':
+        g_listenPath = arg;
+        break;
+      case 'P':
+        g_profile = nullptr;
+        for (auto& profile : QUALITY_PROFILES) {
+          if (arg == profile.name) {
+            g_profile = &profile;
+          }
+        }
+        if (g_profile == nullptr) {
+          std::cerr << "unknown profile " << arg << std::endl;
+          exit(1);
+        }
+        break;
+      case 'b': {
+        auto backend = std::find_if(
+            std::begin(BACKENDS),
+            std::end(BACKENDS),
+            [&arg](const BackendOption& option) { return arg == option.name; });
+        if (backend == std::end(BACKENDS)) {
+          std::cerr << "unknown backend " << arg << std::endl;
+          exit(1);
+        }
+#if !defined(__APPLE__)
+        if (backend->backend == Engine::Backend::METAL) {
+          std::cerr << "the metal backend is only available on macOS"
+                    << std::endl;
+          exit(1);
+        }
+#endif
+        config->backend = backend->backend;
+        break;
+      }
     }
   }
 
   return optind;
 }
 
+// Applies a camera or size setting of the form <key>=<value> to a job. Returns
+// false if the setting is not one of those listed for --view.
+static bool parseViewSetting(const std::string& setting, RenderJob* job) {
+  size_t separator = setting.find('=');
+  if (separator == std::string::npos) {
+    return false;
+  }
+
+  std::string key = setting.substr(0, separator);
+  std::string value = setting.substr(separator + 1);
+  try {
+    if (key == "yaw") {
+      job->yaw = std::stof(value);
+    } else if (key == "pitch") {
+      job->pitch = std::stof(value);
+    } else if (key == "fov") {
+      job->fov = std::stof(value);
+    } else if (key == "width") {
+      job->width = std::stoi(value);
+    } else if (key == "height") {
+      job->height = std::stoi(value);
+    } else if (key == "animation") {
+      job->animation = std::max(std::stoi(value), 0);
+    } else if (key == "time") {
+      job->animationTime = std::max(std::stof(value), 0.0f);
+    } else if (key == "frames") {
+      job->frames = std::max(std::stoi(value), 1);
+    } else {
+      return false;
+    }
+  } catch (const std::exception&) {
+    return false;
+  }
+
+  return job->fov > 0.0f && job->fov < 180.0f && job->width > 0 &&
+      job->height > 0;
+}
+
+// Derives a job from a --view of the model of the base job
+static bool parseView(
+    const std::string& view, const RenderJob& base, RenderJob* job) {
+  *job = base;
+
+  std::istringstream stream(view);
+  std::string setting;
+  if (!std::getline(stream, job->outputPath, ',') || job->outputPath.empty()) {
+    return false;
+  }
+  while (std::getline(stream, setting, ',')) {
+    if (!parseViewSetting(setting, job)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static bool parseManifestLine(const std::string& line, RenderJob* job) {
+  std::vector<std::string> fields;
+  std::istringstream stream(line);
+  std::string field;
+  while (std::getline(stream, field, '\t')) {
+    if (!field.empty()) {
+      fields.push_back(field);
+    }
+  }
+
+  if (fields.size() < 5) {
+    return false;
+  }
+
+  try {
+    job->width = std::stoi(fields[0]);
+    job->height = std::stoi(fields[1]);
+  } catch (const std::exception&) {
+    return false;
+  }
+
+  job->iblDirectory = fields[2];
+  job->outputPath = fields[3];
+
+  size_t i = 4;
+  while (i < fields.size() && fields[i].find('=') != std::string::npos &&
+         parseViewSetting(fields[i], job)) {
+    i++;
+  }
+  for (; i < fields.size(); i++) {
+    job->filenames.push_back(Path(fields[i]));
+  }
+
+  return !job->filenames.empty();
+}
+
+// The output of a frame of a sequence, numbered before the extension
+static std::string frameOutput(const std::string& output, int frame) {
+  char number[16];
+  snprintf(number, sizeof(number), "_%04d", frame + 1);
+  size_t slash = output.find_last_of('/');
+  size_t dot = output.find_last_of('.');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+    return output + number;
+  }
+  return output.substr(0, dot) + number + output.substr(dot);
+}
+
+// Replaces every job that has several frames with a job per frame, stepped
+// at g_frameRate from the time of the job. The frames are consecutive jobs of
+// the same model, so it is only loaded once. Responses to a request are
+// numbered by their order instead.
+static void expandSequences(RenderJobs* jobs) {
+  RenderJobs expanded;
+  for (auto& job : *jobs) {
+    for (int frame = 0; frame < job.frames; frame++) {
+      RenderJob frameJob = job;
+      frameJob.frames = 1;
+      if (job.frames > 1) {
+        frameJob.animationTime =
+            std::max(job.animationTime, 0.0f) + frame / g_frameRate;
+        if (!job.connection || job.outputPath != RESPONSE_OUTPUT) {
+          frameJob.outputPath = frameOutput(job.outputPath, frame);
+        }
+      }
+      expanded.push_back(frameJob);
+    }
+  }
+  jobs->swap(expanded);
+}
+
+static bool loadManifest(const std::string& path, RenderJobs* jobs) {
+  std::ifstream file;
+  if (path != "-") {
+    file.open(path);
+    if (!file) {
+      std::cerr << "manifest " << path << " could not be opened!" << std::endl;
+      return false;
+    }
+  }
+  std::istream& input = path == "-" ? std::cin : file;
+
+  std::string line;
+  int lineNumber = 0;
+  while (std::getline(input, line)) {
+    lineNumber++;
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+
+    RenderJob job;
+    if (!parseManifestLine(line, &job)) {
+      std::cerr << "manifest line " << lineNumber << " is malformed"
+                << std::endl;
+      return false;
+    }
+    jobs->push_back(job);
+  }
+
+  return true;
+}
+
 template <typename T>
 static LinearImage toLinear(
     size_t w, size_t h, size_t bpr, const uint8_t* src) {
   LinearImage result(w, h, 3);
-  math::float3* d = reinterpret_cast<math::float3*>(result.getPixelRef(0, 0));
   for (size_t y = 0; y < h; ++y) {
-    T const* p = reinterpret_cast<T const*>(src + y * bpr);
-    for (size_t x = 0; x < w; ++x, p += 3) {
-      math::float3 sRGB(p[0], p[1], p[2]);
-      sRGB /= std::numeric_limits<T>::max();
-      *d++ = sRGB;
-    }
+    size_t row = g_flipY ? h - 1 - y : y;
+    T const* p = reinterpret_cast<T const*>(src + row * bpr);
+    fidelity::toFloat(p, result.getPixelRef(0, y), w * 3);
   }
   return result;
 }
 
-static void cleanup(Engine* engine, View* view, Scene* scene) {
-  for (auto& item : g_materialInstances) {
+static void hideModel(Scene* scene, const LoadedModel& model) {
+  for (auto entity : model.entities) {
+    scene->remove(entity);
+  }
+}
+
+static void showModel(Engine* engine, Scene* scene, const LoadedModel& model) {
+  auto& rcm = engine->getRenderableManager();
+  for (auto entity : model.entities) {
+    if (rcm.hasComponent(entity)) {
+      auto instance = rcm.getInstance(entity);
+      rcm.setCastShadows(instance, g_profile->shadows);
+      rcm.setReceiveShadows(instance, g_profile->shadows);
+      scene->addEntity(entity);
+    }
+  }
+}
+
+// Releases everything that belongs to a model, leaving the Engine, the light
+// and the IBLs alive.
+static void destroyModel(Engine* engine, Scene* scene, LoadedModel* model) {
+  for (auto& loader : model->resourceLoaders) {
+    loader->asyncCancelLoad();
+  }
+  model->resourceLoaders.clear();
+
+  hideModel(scene, *model);
+
+  for (auto asset : model->assets) {
+    g_assetLoader->destroyAsset(asset);
+  }
+  model->assets.clear();
+  model->mappings.clear();
+
+  for (auto& item : model->materialInstances) {
     auto materialInstance = item.second;
     engine->destroy(materialInstance);
   }
-  g_meshSet.reset(nullptr);
+  model->materialInstances.clear();
+  model->meshSet.reset(nullptr);
+
+  if (g_model == model) {
+    g_model = nullptr;
+  }
+}
+
+// Retires the least recently used models until at most count are left.
+// Their textures stop loading and they leave the scene right away.
+static void evictModels(Scene* scene, size_t count) {
+  while (g_models.size() > count) {
+    LoadedModel* model = g_models.back().get();
+    for (auto& loader : model->resourceLoaders) {
+      loader->asyncCancelLoad();
+    }
+    hideModel(scene, *model);
+    if (g_model == model) {
+      g_model = nullptr;
+    }
+    g_retiredModels.splice(
+        g_retiredModels.end(), g_models, std::prev(g_models.end()));
+  }
+}
+
+// Destroys up to count retired models, oldest first
+static void destroyRetiredModels(Engine* engine, Scene* scene, size_t count) {
+  while (count-- > 0 && !g_retiredModels.empty()) {
+    destroyModel(engine, scene, g_retiredModels.front().get());
+    g_retiredModels.pop_front();
+  }
+}
+
+// Moves the cached item that matches to the front of the cache, returning
+// nullptr if there is none
+template <typename T, typename Predicate>
+static T* useCached(std::list<std::unique_ptr<T>>* cache, Predicate matches) {
+  for (auto it = cache->begin(); it != cache->end(); ++it) {
+    if (matches(**it)) {
+      cache->splice(cache->begin(), *cache, it);
+      return cache->front().get();
+    }
+  }
+  return nullptr;
+}
+
+static void cleanup(Engine* engine, View* view, Scene* scene) {
+  evictModels(scene, 0);
+  destroyRetiredModels(engine, scene, g_retiredModels.size());
   engine->destroy(g_material);
 
+  if (g_assetLoader) {
+    AssetLoader::destroy(&g_assetLoader);
+  }
+  if (g_materialProvider) {
+    g_materialProvider->destroyMaterials();
+    delete g_materialProvider;
+    g_materialProvider = nullptr;
+  }
+
+  scene->setSkybox(nullptr);
+  scene->setIndirectLight(nullptr);
+  g_ibls.clear();
+
   EntityManager& em = EntityManager::get();
   engine->destroy(g_light);
   em.destroy(g_light);
 }
 
-const float FRAMED_HEIGHT = 10.0f;
-const float ROOM_PADDING_SCALE = 1.01f;
-const float FOV = 45.0f;
-
 static float roomDepth = 0.0f;
 
-static void setup(Engine* engine, View* view, Scene* scene) {
-  g_meshSet = std::make_unique<MeshAssimp>(*engine);
-  for (auto& filename : g_filenames) {
-    g_meshSet->addFromFile(filename, g_materialInstances, false);
+// Releases the mapping that a buffer handed to Filament was read from, which
+// is kept alive by a heap-allocated shared_ptr passed as the user data
+static void releaseMapping(void*, size_t, void* user) {
+  delete static_cast<std::shared_ptr<fidelity::MappedFile>*>(user);
+}
+
+// Uploads every level of a cubemap from the pack, returning a pointer past the
+// last face that was consumed
+static const uint8_t* uploadCubemap(
+    Engine* engine,
+    Texture* texture,
+    const std::shared_ptr<fidelity::MappedFile>& file,
+    const uint8_t* data,
+    uint32_t size,
+    uint32_t levels) {
+  for (uint32_t level = 0; level < levels; level++) {
+    size_t faceBytes = fidelity::faceBytes(fidelity::levelSize(size, level));
+
+    Texture::PixelBufferDescriptor buffer(
+        data,
+        faceBytes * fidelity::IBL_PACK_FACES,
+        Texture::Format::RGBM,
+        Texture::Type::UBYTE,
+        releaseMapping,
+        new std::shared_ptr<fidelity::MappedFile>(file));
+
+    Texture::FaceOffsets offsets;
+    for (size_t face = 0; face < fidelity::IBL_PACK_FACES; face++) {
+      offsets[face] = face * faceBytes;
+    }
+
+    texture->setImage(*engine, level, std::move(buffer), offsets);
+    data += faceBytes * fidelity::IBL_PACK_FACES;
   }
+  return data;
+}
 
-  auto& rcm = engine->getRenderableManager();
+static Texture* createCubemap(Engine* engine, uint32_t size, uint32_t levels) {
+  return Texture::Builder()
+      .width(size)
+      .height(size)
+      .levels(uint8_t(levels))
+      .format(Texture::InternalFormat::RGBA8)
+      .rgbm(true)
+      .sampler(Texture::Sampler::SAMPLER_CUBEMAP)
+      .build(*engine);
+}
+
+// Builds the same indirect light and skybox as IBL::loadFromDirectory, but
+// from a pack that needs neither parsing nor decoding
+static std::unique_ptr<PackedIBL> loadPackedIBL(
+    Engine* engine, const std::string& path) {
+  auto file = std::make_shared<fidelity::MappedFile>();
+  const fidelity::IBLPackHeader* header = nullptr;
+  if (!file->open(path) || !(header = fidelity::validatePack(*file))) {
+    return nullptr;
+  }
+
+  auto ibl = std::make_unique<PackedIBL>();
+  ibl->engine = engine;
+  ibl->reflections =
+      createCubemap(engine, header->reflectionsSize, header->reflectionsLevels);
+  ibl->skyboxTexture = createCubemap(engine, header->skyboxSize, 1);
+
+  const uint8_t* data = file->data() + header->dataOffset;
+  data = uploadCubemap(
+      engine,
+      ibl->reflections,
+      file,
+      data,
+      header->reflectionsSize,
+      header->reflectionsLevels);
+  uploadCubemap(
+      engine, ibl->skyboxTexture, file, data, header->skyboxSize, 1);
+
+  float3 bands[fidelity::IBL_PACK_SH_BANDS];
+  for (size_t i = 0; i < fidelity::IBL_PACK_SH_BANDS; i++) {
+    const float* band = header->sphericalHarmonics[i];
+    bands[i] = float3(band[0], band[1], band[2]);
+  }
+
+  ibl->indirectLight = IndirectLight::Builder()
+                           .reflections(ibl->reflections)
+                           .irradiance(3, bands)
+                           .intensity(PACKED_IBL_INTENSITY)
+                           .build(*engine);
+  ibl->skybox = Skybox::Builder()
+                    .environment(ibl->skyboxTexture)
+                    .showSun(true)
+                    .build(*engine);
+  return ibl;
+}
+
+// Loads an IBL, which is either a pack written by ibl_packer or a directory
+// generated by cmgen's deploy option.
+static std::unique_ptr<LoadedIBL> loadIBL(
+    Engine* engine, const std::string& path) {
+  auto loaded = std::make_unique<LoadedIBL>();
+  loaded->path = path;
+
+  Path iblPath(path);
+  if (iblPath.isDirectory()) {
+    loaded->ibl = std::make_unique<IBL>(*engine);
+    if (loaded->ibl->loadFromDirectory(iblPath)) {
+      loaded->indirectLight = loaded->ibl->getIndirectLight();
+      loaded->skybox = loaded->ibl->getSkybox();
+    }
+  } else {
+    loaded->packedIBL = loadPackedIBL(engine, path);
+    if (loaded->packedIBL) {
+      loaded->indirectLight = loaded->packedIBL->indirectLight;
+      loaded->skybox = loaded->packedIBL->skybox;
+    }
+  }
+
+  if (loaded->indirectLight == nullptr) {
+    return nullptr;
+  }
+
+  // Adjust the IBL so that it matches the skybox orientation per
+  // filament.patch
+  loaded->indirectLight->setRotation(
+      mat3f::rotation(M_PI_2, float3{0, 1, 0}));
+  return loaded;
+}
+
+// Applies the IBL of a job to the scene, loading it unless it is cached
+static void setupIBL(Engine* engine, Scene* scene, const RenderJob& job) {
+  LoadedIBL* ibl = useCached(&g_ibls, [&job](const LoadedIBL& cached) {
+    return cached.path == job.iblDirectory;
+  });
+
+  if (ibl == nullptr) {
+    scene->setSkybox(nullptr);
+    scene->setIndirectLight(nullptr);
+    if (job.iblDirectory.empty()) {
+      return;
+    }
+
+    while (g_ibls.size() >= g_cacheSize) {
+      g_ibls.pop_back();
+    }
+
+    std::unique_ptr<LoadedIBL> loaded = loadIBL(engine, job.iblDirectory);
+    if (!loaded) {
+      std::cerr << "Could not load IBL from " << job.iblDirectory << std::endl;
+      return;
+    }
+    g_ibls.push_front(std::move(loaded));
+    ibl = g_ibls.front().get();
+  }
+
+  scene->setSkybox(ibl->skybox);
+  scene->setIndirectLight(ibl->indirectLight);
+}
+
+static fidelity::TileLayout tileLayout(const RenderJob& job) {
+  return fidelity::makeTileLayout(
+      job.width, job.height, g_supersampling, g_maxTileSize);
+}
+
+// Resizes the window so that its drawable matches the tiles of the job,
+// taking into account the backing scale detected by configureWindow.
+static void resizeWindow(const RenderJob& job) {
+  if (g_window == nullptr) {
+    return;
+  }
+
+  fidelity::TileLayout layout = tileLayout(job);
+  int tileWidth = layout.tileWidth;
+  int tileHeight = layout.tileHeight;
+
+  int displayWidth, displayHeight;
+  SDL_GL_GetDrawableSize(g_window, &displayWidth, &displayHeight);
+
+  if (displayWidth != tileWidth || displayHeight != tileHeight) {
+    SDL_SetWindowSize(
+        g_window, tileWidth / g_renderScale, tileHeight / g_renderScale);
+  }
+}
+
+static std::vector<std::string> modelPaths(const RenderJob& job) {
+  std::vector<std::string> paths;
+  for (auto& filename : job.filenames) {
+    paths.push_back(filename.getAbsolutePath());
+  }
+  return paths;
+}
+
+static std::string lowercaseExtension(const Path& filename) {
+  std::string extension = filename.getExtension();
+  std::transform(
+      extension.begin(), extension.end(), extension.begin(), ::tolower);
+  return extension;
+}
+
+static bool isGltf(const Path& filename) {
+  std::string extension = lowercaseExtension(filename);
+  return extension == "gltf" || extension == "glb";
+}
+
+static void releaseShrunkImage(void*, size_t, void* user) {
+  delete static_cast<std::vector<uint8_t>*>(user);
+}
+
+// Hands every external buffer and image of the asset to the loader as a
+// memory mapping, so that neither is read into an intermediate heap buffer
+// before it is uploaded or decoded. Resources that cannot be mapped (e.g.
+// URIs that need decoding) are left for the loader to read itself.
+//
+// Images larger than g_maxTextureSize are shrunk in parallel and handed over
+// instead of their mapping. Only the URIs that the glTF's images refer to are
+// inspected; buffers are handed over as they are. The GPU memory that every
+// mapped resource will take is added to *estimates.
+static void addMappedResources(
+    const Path& filename,
+    const fidelity::MappedFile& gltf,
+    FilamentAsset* asset,
+    ResourceLoader* loader,
+    std::vector<fidelity::ResourceEstimate>* estimates) {
+  Path directory = Path(filename.getAbsolutePath()).getParent();
+  const char* const* uris = asset->getResourceUris();
+
+  const char* json;
+  size_t jsonSize;
+  fidelity::gltfJson(gltf.data(), gltf.size(), &json, &jsonSize);
+  std::set<std::string> images = fidelity::imageUris(json, jsonSize);
+
+  struct MappedResource {
+    const char* uri;
+    std::shared_ptr<fidelity::MappedFile> file;
+    // Not valid for buffers
+    std::future<fidelity::PreparedImage> image;
+  };
+  std::vector<MappedResource> resources;
+
+  for (size_t i = 0; i < asset->getResourceUriCount(); i++) {
+    if (strncmp(uris[i], "data:", 5) == 0) {
+      continue;
+    }
+
+    auto file = std::make_shared<fidelity::MappedFile>();
+    if (!file->open(directory.concat(uris[i]))) {
+      continue;
+    }
+
+    std::future<fidelity::PreparedImage> image;
+    if (images.count(uris[i]) > 0) {
+      image = g_tasks->submit([file]() {
+        return fidelity::prepareImage(
+            file->data(), file->size(), g_maxTextureSize);
+      });
+    }
+    resources.push_back({uris[i], file, std::move(image)});
+  }
+
+  for (auto& resource : resources) {
+    fidelity::PreparedImage image;
+    if (resource.image.valid()) {
+      image = resource.image.get();
+    }
+    estimates->push_back(
+        {directory.concat(resource.uri).getPath(),
+         image.isImage ? fidelity::textureBytes(image.width, image.height)
+                       : resource.file->size()});
+
+    if (!image.shrunk.empty()) {
+      auto* data = new std::vector<uint8_t>(std::move(image.shrunk));
+      loader->addResourceData(
+          resource.uri,
+          ResourceLoader::BufferDescriptor(
+              data->data(), data->size(), releaseShrunkImage, data));
+      continue;
+    }
+
+    loader->addResourceData(
+        resource.uri,
+        ResourceLoader::BufferDescriptor(
+            resource.file->data(),
+            resource.file->size(),
+            releaseMapping,
+            new std::shared_ptr<fidelity::MappedFile>(resource.file)));
+  }
+}
+
+// Parses a glTF or GLB file with gltfio and prepares its resources, which
+// beginLoading starts uploading. Vertex and index buffers are uploaded
+// straight from the file's buffer views (for GLB, from the mapped file
+// itself) instead of being rebuilt on the CPU.
+static bool loadWithGltfio(
+    Engine* engine,
+    const Path& filename,
+    LoadedModel* model,
+    std::vector<fidelity::ResourceEstimate>* estimates) {
+  if (g_assetLoader == nullptr) {
+    g_materialProvider = g_ubershaders || g_profile->ubershaders
+        ? createUbershaderLoader(engine)
+        : createMaterialGenerator(engine);
+    g_assetLoader = AssetLoader::create({engine, g_materialProvider});
+  }
+
+  // The mapping is kept for as long as the asset, which may refer to it
+  auto file = std::make_shared<fidelity::MappedFile>();
+  if (!file->open(filename)) {
+    std::cerr << "Could not map " << filename << std::endl;
+    return false;
+  }
+
+  FilamentAsset* asset = lowercaseExtension(filename) == "gltf"
+      ? g_assetLoader->createAssetFromJson(file->data(), file->size())
+      : g_assetLoader->createAssetFromBinary(file->data(), file->size());
+  if (asset == nullptr) {
+    std::cerr << "Could not parse " << filename << std::endl;
+    return false;
+  }
+  model->assets.push_back(asset);
+  model->mappings.push_back(file);
+
+  // Images embedded in a GLB are only counted at their encoded size
+  estimates->push_back({filename.getPath(), file->size()});
+
+  // Loads external buffers relative to the glTF file
+  auto loader = std::make_unique<ResourceLoader>(ResourceConfiguration{
+      engine, filename.getAbsolutePath(), true, false});
+  addMappedResources(filename, *file, asset, loader.get(), estimates);
+  model->resourceLoaders.push_back(std::move(loader));
+
+  Aabb bounds = asset->getBoundingBox();
+  model->minBound = min(model->minBound, bounds.min);
+  model->maxBound = max(model->maxBound, bounds.max);
+  model->roots.push_back(asset->getRoot());
+  model->entities.insert(
+      model->entities.end(),
+      asset->getEntities(),
+      asset->getEntities() + asset->getEntityCount());
+  return true;
+}
+
+// Starts loading the resources of every gltfio asset of a model. Textures
+// are decoded on the JobSystem's threads and uploaded as they complete,
+// driven by updateResourceLoading.
+static bool beginLoading(LoadedModel* model) {
+  for (size_t i = 0; i < model->assets.size(); i++) {
+    if (!model->resourceLoaders[i]->asyncBeginLoad(model->assets[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Loads the model of a job, unless it is estimated to exceed the memory
+// budget, in which case it is left for the caller to destroy and the reason
+// is recorded in g_job.error. The estimate is made before anything is
+// uploaded or imported.
+static bool loadModel(
+    Engine* engine, const RenderJob& job, LoadedModel* model) {
+  std::vector<fidelity::ResourceEstimate> estimates;
+  std::vector<Path> assimpFilenames;
+  for (auto& filename : job.filenames) {
+    if (g_forceAssimp || !isGltf(filename) ||
+        !loadWithGltfio(engine, filename, model, &estimates)) {
+      assimpFilenames.push_back(filename);
+      // Assimp reads the whole file, so its size is the best guess there is
+      estimates.push_back(
+          {filename.getPath(), fidelity::fileSize(filename.getPath())});
+    }
+  }
+
+  if (g_memoryBudget > 0 && fidelity::totalBytes(estimates) > g_memoryBudget) {
+    std::ostringstream report;
+    fidelity::writeBudgetReport(
+        report, job.outputPath, estimates, g_memoryBudget);
+    std::cerr << report.str();
+    g_job.error = report.str();
+    return false;
+  }
+
+  if (!beginLoading(model)) {
+    g_job.error = "The resources of the model could not be loaded";
+    std::cerr << job.outputPath << ": " << g_job.error << std::endl;
+    return false;
+  }
+
+  if (assimpFilenames.empty()) {
+    return true;
+  }
+
+  model->meshSet = std::make_unique<MeshAssimp>(*engine);
+  MeshAssimp& meshSet = *model->meshSet;
+  for (auto& filename : assimpFilenames) {
+    meshSet.addFromFile(filename, model->materialInstances, false);
+  }
+
+  model->minBound = min(model->minBound, meshSet.minBound);
+  model->maxBound = max(model->maxBound, meshSet.maxBound);
+  model->roots.push_back(meshSet.rootEntity);
+  model->entities.insert(
+      model->entities.end(),
+      meshSet.getRenderables().begin(),
+      meshSet.getRenderables().end());
+  return true;
+}
+
+// Places the model of the current job in the room, whose proportions depend
+// on the aspect ratio of the job
+static void frameModel(Engine* engine, const RenderJob& job) {
+  const LoadedModel& model = *g_model;
   auto& tcm = engine->getTransformManager();
 
   // Scale and translate the model in a way that matches how ModelScene frames
   // a model.
   // @see src/three-components/ModelScene.js
-  float aspect = float(g_config.width) / float(g_config.height);
+  float aspect = float(job.width) / float(job.height);
   float halfWidth = aspect * FRAMED_HEIGHT / 2.0f;
 
   float3 roomMin(-1.0f * halfWidth, 0.0f, -1.0f * halfWidth);
   float3 roomMax(halfWidth, FRAMED_HEIGHT, halfWidth);
   float3 roomSize(
       roomMax.x - roomMin.x, roomMax.y - roomMin.y, roomMax.z - roomMin.z);
-  float3 modelMin = g_meshSet->minBound;
-  float3 modelMax = g_meshSet->maxBound;
+  float3 modelMin = model.minBound;
+  float3 modelMax = model.maxBound;
 
   float3 modelSize = modelMax - modelMin;
 
@@ -207,10 +1468,11 @@ static void setup(Engine* engine, View* view, Scene* scene) {
 
   float3 center = (roomCenter - modelCenter);
 
-  auto rooti = tcm.getInstance(g_meshSet->rootEntity);
-
-  tcm.setTransform(
-      rooti, mat4f::translation(center) * mat4f::scaling(float3(scale)));
+  for (auto root : model.roots) {
+    tcm.setTransform(
+        tcm.getInstance(root),
+        mat4f::translation(center) * mat4f::scaling(float3(scale)));
+  }
 
   if (modelSize.y >= modelSize.x && modelSize.y >= modelSize.z) {
     roomDepth = std::max(modelSize.x, modelSize.z) * scale * ROOM_PADDING_SCALE;
@@ -229,18 +1491,95 @@ static void setup(Engine* engine, View* view, Scene* scene) {
   std::cout << "Model center: " << modelCenter << std::endl;
   std::cout << "Center: " << center << std::endl;
   std::cout << "Scale: " << scale << std::endl;
-  std::cout << "Model translation: " << tcm.getTransform(rooti)[3].xyz
+  std::cout << "Model translation: "
+            << tcm.getTransform(tcm.getInstance(model.roots[0]))[3].xyz
             << std::endl;
   */
+}
 
-  for (auto renderable : g_meshSet->getRenderables()) {
-    if (rcm.hasComponent(renderable)) {
-      auto instance = rcm.getInstance(renderable);
-      rcm.setCastShadows(instance, true);
-      rcm.setReceiveShadows(instance, true);
-      scene->addEntity(renderable);
+// Poses the model of the current job at the animation time of the job.
+// Animations that are shorter loop, as they do in <model-viewer>.
+static void poseModel(const RenderJob& job) {
+  if (job.animationTime < 0.0f) {
+    return;
+  }
+
+  for (auto asset : g_model->assets) {
+    Animator* animator = asset->getAnimator();
+    if (animator == nullptr ||
+        size_t(job.animation) >= animator->getAnimationCount()) {
+      continue;
     }
+    float duration = animator->getAnimationDuration(job.animation);
+    float time =
+        duration > 0.0f ? std::fmod(job.animationTime, duration) : 0.0f;
+    animator->applyAnimation(job.animation, time);
+    animator->updateBoneMatrices();
+    g_model->posed = true;
   }
+}
+
+// Sets up the IBL and the model of a job, loading those that are not cached,
+// and frames the model for the job. A model that cannot be loaded leaves the
+// scene empty and the job to be failed by postRender.
+static void setupModel(Engine* engine, Scene* scene, const RenderJob& job) {
+  JobStats& stats = statsAt(g_currentJob);
+
+  // Decoding a large golden takes about as long as comparing it, so it is
+  // done while the job renders rather than after its capture
+  if (g_compare) {
+    std::shared_ptr<GoldenImage> golden =
+        std::make_shared<GoldenImage>(job.goldenPath);
+    g_job.golden = golden;
+    g_tasks->submit([golden]() { golden->get(); });
+  }
+
+  fidelity::Clock::time_point start = fidelity::Clock::now();
+  setupIBL(engine, scene, job);
+  stats.iblLoad = fidelity::millisecondsSince(start);
+
+  // A posed model cannot be returned to its rest pose, so jobs without an
+  // animation time load the model again
+  std::vector<std::string> paths = modelPaths(job);
+  LoadedModel* model =
+      useCached(&g_models, [&paths, &job](const LoadedModel& m) {
+        return m.paths == paths && (job.animationTime >= 0.0f || !m.posed);
+      });
+
+  if (g_model != nullptr && g_model != model) {
+    hideModel(scene, *g_model);
+    g_model = nullptr;
+  }
+
+  if (model == nullptr) {
+    evictModels(scene, g_cacheSize - 1);
+
+    start = fidelity::Clock::now();
+    g_models.emplace_front(new LoadedModel);
+    model = g_models.front().get();
+    model->paths = paths;
+    bool loaded = loadModel(engine, job, model);
+    stats.modelLoad = fidelity::millisecondsSince(start);
+
+    if (!loaded) {
+      destroyModel(engine, scene, model);
+      g_models.pop_front();
+      return;
+    }
+  }
+
+  if (g_model == nullptr) {
+    showModel(engine, scene, *model);
+    g_model = model;
+  }
+
+  g_job.texturesStart = fidelity::Clock::now();
+  frameModel(engine, job);
+  poseModel(job);
+}
+
+static void setup(Engine* engine, View* view, Scene* scene) {
+  g_engineInit = fidelity::millisecondsSince(g_startTime);
 
   g_light = EntityManager::get().create();
   LightManager::Builder(LightManager::Type::SUN)
@@ -252,100 +1591,910 @@ static void setup(Engine* engine, View* view, Scene* scene) {
 
   scene->addEntity(g_light);
 
-  // Adjust the IBL so that it matches the skybox orientation per
-  // filament.patch
-  FilamentApp& filamentApp = FilamentApp::get();
-  IBL* ibl = filamentApp.getIBL();
-  ibl->getIndirectLight()->setRotation(mat3f::rotation(M_PI_2, float3{0, 1, 0}));
-}
-
-static void preRender(Engine*, View* view, Scene*, Renderer*) {
-  // Adjust the camera projection and translation in a way that is similar to
-  // what ModelScene does.
-  // NOTE(cdata): This might be inefficient to do every prerender, but since we
-  // only wait for one frame before exiting it shouldn't matter in practice.
-  // Also: while spelunking it appeared that the camera has its projection
-  // and position updated multiple times per frame by other implementation
-  // outside of our control. This is why we must make these adjustments during
-  // preRender.
-  // @see src/three-components/ModelScene.js
-  float aspect = float(g_config.width) / float(g_config.height);
-  float halfWidth = aspect * FRAMED_HEIGHT / 2.0f;
-  float near = (FRAMED_HEIGHT / 2.0f) / std::tan((FOV / 2.0f) * M_PI / 180.0f);
+  view->setShadowsEnabled(g_profile->shadows);
+  view->setPostProcessingEnabled(g_profile->postProcessing);
+  if (g_deterministic) {
+    view->setDithering(View::Dithering::NONE);
+  }
+  if (g_profile->sampleCount > 0) {
+    view->setSampleCount(g_profile->sampleCount);
+  }
 
-  Camera& camera = view->getCamera();
+  // A server may start without any jobs
+  if (!g_jobs.empty()) {
+    setupModel(engine, scene, jobAt(g_currentJob));
+  }
+}
 
-  camera.setProjection(FOV, aspect, near, 100.0f);
-  camera.setModelMatrix(mat4f::translation(
-      float3(0.0f, FRAMED_HEIGHT / 2.0f, (roomDepth / 2.0f) + near)));
+static void respondWithError(
+    fidelity::Connection* connection, const std::string& error) {
+  std::ostringstream response;
+  response << "{\"error\":";
+  fidelity::writeJSONString(response, error);
+  response << "}\n";
+  connection->write(response.str());
 }
 
-static void postRender(Engine*, View* view, Scene*, Renderer* renderer) {
-  int frame = g_currentFrame - FRAME_TO_SKIP - 1;
-  // Account for the back buffer
-  if (frame == 1) {
-    std::cout << "Rendering\n";
-    const Viewport& vp = view->getViewport();
-    uint8_t* pixels = new uint8_t[vp.width * vp.height * 3];
+// Hashes everything the capture of a job depends on: the renderer binary
+// (and with it the Filament it was built with), the model files and the
+// external resources of glTF files, the IBL, and the settings that affect the
+// pixels. Returns an empty digest, which never matches, if a file cannot be
+// read.
+static std::string inputDigest(const RenderJob& job) {
+  uint64_t hash = g_rendererDigest;
+  for (auto& filename : job.filenames) {
+    if (!fidelity::hashPath(filename.getAbsolutePath(), &hash)) {
+      return "";
+    }
 
-    struct CaptureState {
-      View* view = nullptr;
-    };
+    fidelity::MappedFile file;
+    if (lowercaseExtension(filename) != "gltf" || !file.open(filename)) {
+      continue;
+    }
+    Path directory = Path(filename.getAbsolutePath()).getParent();
+    for (auto& uri : fidelity::externalUris(file.data(), file.size())) {
+      if (!fidelity::hashPath(directory.concat(uri).getPath(), &hash)) {
+        return "";
+      }
+    }
+  }
 
-    driver::PixelBufferDescriptor buffer(
-        pixels,
-        vp.width * vp.height * 3,
-        driver::PixelBufferDescriptor::PixelDataFormat::RGB,
-        driver::PixelBufferDescriptor::PixelDataType::UBYTE,
-        [](void* buffer, size_t size, void* user) {
-          if (size > 0) {
-            CaptureState* state = static_cast<CaptureState*>(user);
-            const Viewport& v = state->view->getViewport();
+  if (!job.iblDirectory.empty() &&
+      !fidelity::hashPath(job.iblDirectory, &hash)) {
+    return "";
+  }
 
-            LinearImage image(toLinear<uint8_t>(
-                v.width, v.height, v.width * 3, static_cast<uint8_t*>(buffer)));
+  std::ostringstream settings;
+  settings << job.width << " " << job.height << " " << job.yaw << " "
+           << job.pitch << " " << job.fov << " " << g_profile->name << " "
+           << g_maxWarmupFrames << " " << g_supersampling << " "
+           << g_maxTileSize << " " << g_maxTextureSize << " " << g_flipY
+           << " " << g_floatReadback << " " << g_forceAssimp << " "
+           << g_ubershaders << " " << int(g_config.backend) << " "
+           << job.animation << " " << job.animationTime;
+  return fidelity::hexDigest(fidelity::hashString(settings.str(), hash));
+}
 
-            std::string name = g_config.outputPath;
-            Path out(name);
+// Releases everything that earlier jobs left loaded in one go: the cached and
+// retired models, the IBLs and the staging buffers. Waits for the GPU, so
+// that Filament has freed what they held before the next job allocates.
+static void resetScene(Engine* engine, Scene* scene) {
+  evictModels(scene, 0);
+  destroyRetiredModels(engine, scene, g_retiredModels.size());
 
-            std::ofstream outputStream(out, std::ios::binary | std::ios::trunc);
-            ImageEncoder::encode(
-                outputStream, ImageEncoder::Format::PNG, image, "", name);
+  scene->setSkybox(nullptr);
+  scene->setIndirectLight(nullptr);
+  g_ibls.clear();
 
-            delete[] static_cast<uint8_t*>(buffer);
-            delete state;
+  g_stagingBuffers.clear();
+  Fence::waitAndDestroy(engine->createFence());
+}
 
-            g_rendered = true;
-          }
-        },
-        new CaptureState{view});
+// Appends a job for the next valid request received with --listen, waiting
+// up to REQUEST_POLL_INTERVAL for one. Returns false if there is none yet.
+static bool receiveRequest(Engine* engine, Scene* scene) {
+  fidelity::Request request;
+  while (g_server.receive(&request, REQUEST_POLL_INTERVAL)) {
+    if (request.line == "quit") {
+      FilamentApp::get().close();
+      return false;
+    }
+    if (request.line == "reset") {
+      resetScene(engine, scene);
+      continue;
+    }
+    if (request.line.empty() || request.line[0] == '#') {
+      continue;
+    }
 
-    renderer->readPixels(
-        (uint32_t)vp.left,
-        (uint32_t)vp.bottom,
-        vp.width,
-        vp.height,
-        std::move(buffer));
+    RenderJob job;
+    if (!parseManifestLine(request.line, &job)) {
+      respondWithError(request.connection.get(), "The job is malformed");
+      continue;
+    }
+
+    auto missing = std::find_if(
+        job.filenames.begin(), job.filenames.end(), [](const Path& filename) {
+          return !filename.exists();
+        });
+    if (missing != job.filenames.end()) {
+      respondWithError(
+          request.connection.get(), missing->getPath() + " was not found");
+      continue;
+    }
+
+    job.connection = request.connection;
+    RenderJobs jobs = {job};
+    expandSequences(&jobs);
+    for (auto& frameJob : jobs) {
+      if (!g_digestsPath.empty()) {
+        frameJob.inputDigest = inputDigest(frameJob);
+      }
+      if (g_compare) {
+        frameJob.goldenPath =
+            g_goldenPath.empty() ? frameJob.outputPath : g_goldenPath;
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(g_jobsMutex);
+    size_t reported = std::min(g_reportedJobs.load(), g_currentJob);
+    for (; g_firstJob < reported; g_firstJob++) {
+      g_jobs.pop_front();
+      g_stats.pop_front();
+    }
+    g_jobs.insert(g_jobs.end(), jobs.begin(), jobs.end());
+    g_stats.resize(g_jobs.size());
+    return true;
   }
+  return false;
+}
+
+// Reports a job whose model could not be loaded, on g_encoder so that it is
+// reported after the jobs before it
+static void failJob() {
+  size_t jobIndex = g_currentJob;
+  std::string error = g_job.error;
+  g_job.error.clear();
+
+  g_encoder.post([jobIndex, error]() {
+    RenderJob& job = jobAt(jobIndex);
+    g_failedJobs++;
+    if (g_compare && g_listenPath.empty()) {
+      std::ostringstream result;
+      result << "{\"output\":";
+      fidelity::writeJSONString(result, job.outputPath);
+      result << ",\"golden\":";
+      fidelity::writeJSONString(result, job.goldenPath);
+      result << ",\"error\":";
+      fidelity::writeJSONString(result, error);
+      result << ",\"passed\":false}";
+      g_results.push_back(result.str());
+    }
+    if (job.connection) {
+      respondWithError(job.connection.get(), error);
+      job.connection.reset();
+    }
+    g_reportedJobs++;
+  });
+}
+
+static void startJob(Engine* engine, Scene* scene) {
+  const RenderJob& job = jobAt(g_currentJob);
+  g_job = JobContext();
+  resizeWindow(job);
+  setupModel(engine, scene, job);
+}
 
-  if (g_rendered == true) {
+// Moves on to the next job in the manifest, or to the next request when
+// listening. Closes the app if there are no jobs left otherwise.
+static void advanceJob(Engine* engine, Scene* scene) {
+  g_currentJob++;
+  if (g_currentJob < jobCount() ||
+      (!g_listenPath.empty() && receiveRequest(engine, scene))) {
+    startJob(engine, scene);
+  } else if (g_listenPath.empty()) {
     FilamentApp::get().close();
   }
+}
+
+// The camera of the current job and tile, derived in a way that is similar to
+// what ModelScene does.
+// @see src/three-components/ModelScene.js
+struct CameraSetup {
+  size_t jobIndex = std::numeric_limits<size_t>::max();
+  uint32_t tileIndex = 0;
+  Viewport viewport;
+  double left = 0.0;
+  double right = 0.0;
+  double bottom = 0.0;
+  double top = 0.0;
+  double near = 0.0;
+  mat4f modelMatrix;
+};
+
+static CameraSetup g_camera;
+
+static void updateCameraSetup(const RenderJob& job, const Viewport& viewport) {
+  float aspect = float(job.width) / float(job.height);
+  float near =
+      (FRAMED_HEIGHT / 2.0f) / std::tan((job.fov / 2.0f) * M_PI / 180.0f);
+
+  g_camera.jobIndex = g_currentJob;
+  g_camera.tileIndex = g_job.currentTile;
+  g_camera.viewport = viewport;
+  g_camera.near = near;
+
+  // Each tile sees its own part of the frustum of the whole render; a single
+  // tile sees all of it
+  double top = near * std::tan((job.fov / 2.0) * M_PI / 180.0);
+  fidelity::tileFrustum(
+      tileLayout(job),
+      g_job.currentTile,
+      top * aspect,
+      top,
+      &g_camera.left,
+      &g_camera.right,
+      &g_camera.bottom,
+      &g_camera.top);
+
+  // The camera orbits the center of the room, at the distance it would have
+  // from the front of the room
+  float yaw = job.yaw * M_PI / 180.0f;
+  float pitch = job.pitch * M_PI / 180.0f;
+  g_camera.modelMatrix =
+      mat4f::translation(float3(0.0f, FRAMED_HEIGHT / 2.0f, 0.0f)) *
+      mat4f::rotation(yaw, float3(0.0f, 1.0f, 0.0f)) *
+      mat4f::rotation(-pitch, float3(1.0f, 0.0f, 0.0f)) *
+      mat4f::translation(float3(0.0f, 0.0f, (roomDepth / 2.0f) + near));
+}
+
+static void preRender(Engine*, View* view, Scene*, Renderer* renderer) {
+  if (g_currentJob >= jobCount()) {
+    return;
+  }
+
+  // Materials that animate with the time see every frame at time zero
+  if (g_deterministic) {
+    renderer->resetUserTime();
+  }
+
+  // FilamentApp sets up the projection of the camera whenever the window is
+  // resized, and its camera manipulator may move the camera on any frame. The
+  // camera setup is only derived again when the job, the tile or the viewport
+  // changes, but its model matrix is applied on every frame.
+  const RenderJob& job = jobAt(g_currentJob);
+  const Viewport& vp = view->getViewport();
+  Camera& camera = view->getCamera();
+
+  if (g_camera.jobIndex != g_currentJob ||
+      g_camera.tileIndex != g_job.currentTile ||
+      g_camera.viewport.left != vp.left ||
+      g_camera.viewport.bottom != vp.bottom ||
+      g_camera.viewport.width != vp.width ||
+      g_camera.viewport.height != vp.height) {
+    updateCameraSetup(job, vp);
+
+    if (tileLayout(job).isSingleTile()) {
+      float aspect = float(job.width) / float(job.height);
+      camera.setProjection(job.fov, aspect, g_camera.near, 100.0f);
+    } else {
+      camera.setProjection(
+          Camera::Projection::PERSPECTIVE,
+          g_camera.left,
+          g_camera.right,
+          g_camera.bottom,
+          g_camera.top,
+          g_camera.near,
+          100.0);
+    }
+  }
+
+  camera.setModelMatrix(g_camera.modelMatrix);
+}
+
+// Readbacks may outlive the frame, and even the job, that issued them: up to
+// MAX_CAPTURES_IN_FLIGHT of them are pending at once so that the transfer of
+// one frame overlaps the rendering of the next, and accepted captures are
+// encoded on g_tasks while the next job is already being rendered.
+const size_t MAX_CAPTURES_IN_FLIGHT = 2;
+
+struct CaptureState {
+  size_t jobIndex = 0;
+  uint32_t tileIndex = 0;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  bool final = false;
+  // RGB float components rather than RGB8
+  bool floatComponents = false;
+  std::shared_ptr<GoldenImage> golden;
+  fidelity::Clock::time_point issued;
+  fidelity::Clock::time_point completed;
+  fidelity::StagingBuffer buffer;
+  // Number of bytes read back, zero if the readback failed
+  size_t size = 0;
+};
+
+static fidelity::CompletionQueue<std::unique_ptr<CaptureState>>
+    g_completedCaptures;
+static std::unique_ptr<CaptureState> g_previousCapture;
+static size_t g_capturesInFlight = 0;
+// The tiles of the current job are assembled into this capture
+static std::unique_ptr<CaptureState> g_tiledCapture;
+
+// Each byte of the readback is passed through a lookup table that applies the
+// same sRGB transfer function as ImageEncoder::Format::PNG, so PNGs written
+// straight from the readback are identical to those of the float path.
+static const uint8_t* sRGBTable() {
+  static const std::vector<uint8_t> table = []() {
+    std::vector<uint8_t> table(256);
+    for (size_t i = 0; i < table.size(); i++) {
+      float sRGB = linearToSRGB(float(i) / 255.0f);
+      table[i] = uint8_t(std::min(std::max(sRGB, 0.0f), 1.0f) * 255.0f + 0.5f);
+    }
+    return table;
+  }();
+  return table.data();
+}
+
+// Compares the capture to the golden of the current job without a PNG round
+// trip: the readback goes through the same sRGB table as the PNG encoder, and
+// the golden is decoded straight to RGBA like the fidelity tests do. The result
+// is returned for the JSON output. Returns true when no pixel exceeds the
+// largest threshold, in which case the capture does not need to be written.
+static bool compareCapture(
+    const CaptureState& state, const uint8_t* pixels, std::string* output) {
+  const RenderJob& job = jobAt(state.jobIndex);
+
+  std::ostringstream result;
+  result << "{\"output\":";
+  fidelity::writeJSONString(result, job.outputPath);
+  result << ",\"golden\":";
+  fidelity::writeJSONString(result, job.goldenPath);
+
+  bool passed = false;
+  std::shared_ptr<fidelity::DecodedImage> golden = state.golden->get();
+  if (!golden) {
+    result << ",\"error\":\"The golden could not be decoded\"";
+  } else if (
+      uint32_t(golden->width) != state.width ||
+      uint32_t(golden->height) != state.height) {
+    result << ",\"error\":\"The golden is " << golden->width << " x "
+           << golden->height << "\"";
+  } else {
+    // Already runs on a pool thread alongside other captures' tasks, so it
+    // compares on this thread alone rather than spawning one per core
+    fidelity::ImageComparator comparator(
+        fidelity::ImageView{pixels, 3, g_flipY, sRGBTable()},
+        fidelity::ImageView{golden->pixels.get()},
+        state.width,
+        state.height,
+        1);
+    std::vector<fidelity::ImageComparisonResult> analysis =
+        comparator.analyze(g_thresholds, false);
+
+    size_t loosest =
+        std::max_element(g_thresholds.begin(), g_thresholds.end()) -
+        g_thresholds.begin();
+    passed = analysis[loosest].analysis.matchingRatio == 1.0;
+
+    result << ",\"analysis\":";
+    fidelity::writeAnalysis(result, analysis);
+  }
+
+  result << ",\"passed\":" << (passed ? "true" : "false") << "}";
+  *output = result.str();
+  return passed;
+}
+
+static void writeStats() {
+  std::ofstream out(g_statsPath, std::ios::trunc);
+  out << "{\"engineInit\":" << g_engineInit << ",\"jobs\":[";
+  for (size_t i = 0; i < g_jobs.size(); i++) {
+    const JobStats& stats = g_stats[i];
+    out << (i > 0 ? "," : "") << "{\"output\":";
+    fidelity::writeJSONString(out, g_jobs[i].outputPath);
+    out << ",\"iblLoad\":" << stats.iblLoad
+        << ",\"modelLoad\":" << stats.modelLoad
+        << ",\"textureDecode\":" << stats.textureDecode
+        << ",\"warmup\":" << stats.warmup
+        << ",\"warmupFrames\":" << stats.warmupFrames
+        << ",\"averageFrame\":" << stats.averageFrame
+        << ",\"readback\":" << stats.readback
+        << ",\"compare\":" << stats.compare
+        << ",\"encode\":" << stats.encode
+        << ",\"peakResidentBytes\":" << stats.peakResidentBytes << "}";
+  }
+  out << "]}" << std::endl;
+
+  if (!out) {
+    std::cerr << "Could not write " << g_statsPath << std::endl;
+  }
+}
+
+static void writeResults() {
+  std::ofstream file;
+  if (!g_resultsPath.empty()) {
+    file.open(g_resultsPath, std::ios::trunc);
+  }
+  std::ostream& out = g_resultsPath.empty() ? std::cout : file;
+
+  out << "[";
+  for (size_t i = 0; i < g_results.size(); i++) {
+    out << (i > 0 ? "," : "") << g_results[i];
+  }
+  out << "]" << std::endl;
+}
+
+// Writes a capture, given its RGB8 pixels. Float captures are only written
+// from their original components to the formats of ImageEncoder other than
+// PNG (e.g. EXR or HDR), which are the only ones that need the float image.
+// Captures returned in a response are always PNGs. Returns false if the capture
+// could not be written.
+static bool writeCapture(
+    const CaptureState& state,
+    const uint8_t* pixels,
+    const std::string& name,
+    std::ostream& outputStream) {
+  std::string extension = lowercaseExtension(Path(name));
+  if (extension == "qoi" || extension == "ppm") {
+    bool encoded = extension == "qoi"
+        ? fidelity::encodeQOI(
+              outputStream,
+              pixels,
+              state.width,
+              state.height,
+              3,
+              g_flipY,
+              sRGBTable())
+        : fidelity::encodePPM(
+              outputStream,
+              pixels,
+              state.width,
+              state.height,
+              g_flipY,
+              sRGBTable());
+    if (!encoded) {
+      std::cerr << "Could not encode " << name << std::endl;
+    }
+    return encoded;
+  }
+
+  ImageEncoder::Format format = name == RESPONSE_OUTPUT
+      ? ImageEncoder::Format::PNG
+      : ImageEncoder::chooseFormat(name);
+  if (format == ImageEncoder::Format::PNG) {
+    if (!fidelity::encodePNG(
+            outputStream,
+            pixels,
+            state.width,
+            state.height,
+            3,
+            g_flipY,
+            sRGBTable(),
+            g_pngOptions)) {
+      std::cerr << "Could not encode " << name << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  LinearImage image(
+      state.floatComponents
+          ? toLinear<float>(
+                state.width,
+                state.height,
+                state.width * 3 * sizeof(float),
+                state.buffer.data.get())
+          : toLinear<uint8_t>(
+                state.width, state.height, state.width * 3, pixels));
+  if (!ImageEncoder::encode(outputStream, format, image, "", name) ||
+      !outputStream) {
+    std::cerr << "Could not encode " << name << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Sends the response to a job received with --listen, followed by the
+// encoded image if it was asked for
+static void respond(
+    const RenderJob& job, bool passed, const std::string& image) {
+  std::ostringstream response;
+  response << "{\"output\":";
+  fidelity::writeJSONString(response, job.outputPath);
+  if (g_compare) {
+    response << ",\"passed\":" << (passed ? "true" : "false");
+  }
+  response << ",\"bytes\":" << image.size() << "}\n";
+  if (job.connection->write(response.str()) && !image.empty()) {
+    job.connection->write(image);
+  }
+}
+
+// What encodeCapture leaves for reportCapture
+struct EncodedCapture {
+  size_t jobIndex = 0;
+  bool passed = false;
+  std::string result;
+  bool unchanged = false;
+  // Whether the capture could not be written
+  bool failed = false;
+  // Empty unless the digest of the output needs to be recorded
+  std::string digest;
+  // The encoded image, when it is returned in the response
+  std::string image;
+};
+
+// Runs on g_tasks once a capture has been accepted, possibly at the same time
+// as the captures of other jobs
+static EncodedCapture encodeCapture(const CaptureState& state) {
+  const RenderJob& job = jobAt(state.jobIndex);
+  JobStats& stats = statsAt(state.jobIndex);
+  const uint8_t* pixels = state.buffer.data.get();
+
+  // Float captures are compared, and written as PNGs, like RGB8 ones
+  fidelity::StagingBuffer quantized;
+  if (state.floatComponents) {
+    size_t count = size_t(state.width) * state.height * 3;
+    quantized = g_stagingBuffers.acquire(count);
+    fidelity::fromFloat(
+        reinterpret_cast<const float*>(pixels), quantized.data.get(), count);
+    pixels = quantized.data.get();
+  }
+
+  EncodedCapture encoded;
+  encoded.jobIndex = state.jobIndex;
+
+  // An output that already holds exactly these pixels is not written again
+  const bool recorded = !g_digestsPath.empty() && !job.outputPath.empty() &&
+      !(job.connection && job.outputPath == RESPONSE_OUTPUT);
+  std::string digest;
+  if (recorded) {
+    size_t size = size_t(state.width) * state.height * 3 *
+        (state.floatComponents ? sizeof(float) : sizeof(uint8_t));
+    digest = fidelity::hexDigest(
+        fidelity::hashBytes(state.buffer.data.get(), size));
+    auto record = g_recordedDigests.find(job.outputPath);
+    encoded.unchanged = record != g_recordedDigests.end() &&
+        record->second.pixels == digest && Path(job.outputPath).exists();
+  }
+
+  fidelity::Clock::time_point start = fidelity::Clock::now();
+  encoded.passed = g_compare && compareCapture(state, pixels, &encoded.result);
+  stats.compare = fidelity::millisecondsSince(start);
+
+  // The digest of a capture that passed is only recorded if the output has
+  // its pixels, since it is not written
+  if (recorded && (encoded.unchanged || !encoded.passed)) {
+    encoded.digest = digest;
+  }
+
+  if (!encoded.passed && !encoded.unchanged && !job.outputPath.empty()) {
+    start = fidelity::Clock::now();
+    if (job.connection && job.outputPath == RESPONSE_OUTPUT) {
+      std::ostringstream image;
+      encoded.failed = !writeCapture(state, pixels, job.outputPath, image);
+      encoded.image = image.str();
+    } else {
+      std::ofstream file(
+          Path(job.outputPath), std::ios::binary | std::ios::trunc);
+      if (!file) {
+        std::cerr << "Could not open " << job.outputPath << std::endl;
+        encoded.failed = true;
+      } else {
+        encoded.failed = !writeCapture(state, pixels, job.outputPath, file);
+      }
+    }
+    stats.encode = fidelity::millisecondsSince(start);
+  }
+
+  g_stagingBuffers.release(std::move(quantized));
+  return encoded;
+}
+
+// Runs on g_encoder, in the order of the jobs, once their capture has been
+// encoded
+static void reportCapture(const EncodedCapture& encoded) {
+  RenderJob& job = jobAt(encoded.jobIndex);
+
+  if (g_compare) {
+    // Clients of --listen get the outcome of their jobs in the responses
+    if (g_listenPath.empty()) {
+      g_results.push_back(encoded.result);
+    }
+    std::cout << job.outputPath
+              << (encoded.passed ? " matches " : " differs from ")
+              << job.goldenPath << std::endl;
+  }
+  if (encoded.unchanged) {
+    std::cout << job.outputPath << " is unchanged" << std::endl;
+  }
+  if (encoded.failed) {
+    g_failedJobs++;
+  } else if (!encoded.digest.empty()) {
+    g_digests[job.outputPath] = {job.inputDigest, encoded.digest};
+  }
+  if (job.connection) {
+    respond(job, encoded.passed, encoded.image);
+    job.connection.reset();
+  }
 
-  g_currentFrame++;
+  statsAt(encoded.jobIndex).peakResidentBytes = fidelity::peakResidentBytes();
+  g_reportedJobs++;
+}
+
+// Called once a readback has completed, possibly on a driver thread. The
+// capture is handed over to the render loop, which inspects it in
+// collectCaptures.
+static void onCaptureRead(void*, size_t size, void* user) {
+  std::unique_ptr<CaptureState> state(static_cast<CaptureState*>(user));
+  state->completed = fidelity::Clock::now();
+  state->size = size;
+  g_completedCaptures.push(std::move(state));
+}
+
+// Replaces a supersampled capture with its resolved, output sized version
+static void resolveCapture(CaptureState* state) {
+  const RenderJob& job = jobAt(state->jobIndex);
+  if (state->width == uint32_t(job.width) || g_supersampling <= 1) {
+    return;
+  }
+
+  size_t size = size_t(job.width) * job.height * 3;
+  fidelity::StagingBuffer resolved = g_stagingBuffers.acquire(size);
+  fidelity::downsample(
+      state->buffer.data.get(),
+      job.width,
+      job.height,
+      g_supersampling,
+      resolved.data.get());
+
+  g_stagingBuffers.release(std::move(state->buffer));
+  state->buffer = std::move(resolved);
+  state->width = job.width;
+  state->height = job.height;
+  state->size = size;
+}
+
+// Copies an accepted tile into the capture of the whole job. Returns true once
+// the last tile is in, leaving the assembled capture in *capture; otherwise
+// the next tile is started and goes through the warm-up like the first one.
+static bool assembleTile(std::unique_ptr<CaptureState>* capture) {
+  const fidelity::TileLayout layout = tileLayout(jobAt(g_currentJob));
+  if (layout.isSingleTile()) {
+    return true;
+  }
+
+  CaptureState& tile = **capture;
+  if (!g_tiledCapture) {
+    size_t size = size_t(layout.renderWidth) * layout.renderHeight * 3;
+    g_tiledCapture.reset(new CaptureState);
+    g_tiledCapture->jobIndex = tile.jobIndex;
+    g_tiledCapture->width = layout.renderWidth;
+    g_tiledCapture->height = layout.renderHeight;
+    g_tiledCapture->golden = tile.golden;
+    g_tiledCapture->size = size;
+    g_tiledCapture->buffer = g_stagingBuffers.acquire(size);
+  }
+
+  fidelity::copyTile(
+      layout,
+      tile.tileIndex,
+      tile.buffer.data.get(),
+      g_tiledCapture->buffer.data.get());
+  g_tiledCapture->final = g_tiledCapture->final || tile.final;
+  g_tiledCapture->issued = tile.issued;
+  g_tiledCapture->completed = tile.completed;
+  g_stagingBuffers.release(std::move(tile.buffer));
+  capture->reset(nullptr);
+
+  if (++g_job.currentTile < layout.tileCount()) {
+    g_job.currentFrame = 0;
+    return false;
+  }
+
+  *capture = std::move(g_tiledCapture);
+  return true;
+}
+
+// Goes through the readbacks that have completed since the last frame, in the
+// order they were issued. A capture is accepted as soon as it is identical to
+// the one that preceded it, or when we have run out of warm-up frames, and is
+// then encoded in the background. Returns true if the current job's capture
+// was accepted.
+static bool collectCaptures() {
+  bool accepted = false;
+  std::unique_ptr<CaptureState> capture;
+
+  while (g_completedCaptures.pop(&capture)) {
+    g_capturesInFlight--;
+
+    // Failed readbacks, and those that were still in flight when their job
+    // was done, are of no use anymore
+    if (accepted || capture->jobIndex != g_currentJob ||
+        capture->tileIndex != g_job.currentTile || capture->size == 0) {
+      g_stagingBuffers.release(std::move(capture->buffer));
+      continue;
+    }
+
+    bool stable = g_previousCapture &&
+        g_previousCapture->size == capture->size &&
+        memcmp(g_previousCapture->buffer.data.get(),
+               capture->buffer.data.get(),
+               capture->size) == 0;
+
+    if (g_previousCapture) {
+      g_stagingBuffers.release(std::move(g_previousCapture->buffer));
+      g_previousCapture.reset(nullptr);
+    }
+
+    if (!stable && !capture->final) {
+      g_previousCapture = std::move(capture);
+      continue;
+    }
+
+    if (!assembleTile(&capture)) {
+      continue;
+    }
+
+    std::cout << "Rendering " << jobAt(capture->jobIndex).outputPath
+              << " after " << g_job.currentFrame << " frames" << std::endl;
+
+    JobStats& stats = statsAt(capture->jobIndex);
+    stats.warmup = fidelity::millisecondsSince(g_job.warmupStart);
+    stats.warmupFrames = g_job.currentFrame;
+    stats.averageFrame =
+        g_job.frameCount > 0 ? g_job.frameTimeTotal / g_job.frameCount : 0;
+    stats.readback =
+        fidelity::millisecondsBetween(capture->issued, capture->completed);
+
+    // Captures are encoded on g_tasks, several at once if they come faster
+    // than a single thread encodes them, and then reported on g_encoder in
+    // the order of their jobs
+    std::shared_ptr<CaptureState> state(std::move(capture));
+    std::shared_future<EncodedCapture> encoded =
+        g_tasks
+            ->submit([state]() {
+              resolveCapture(state.get());
+              EncodedCapture encoded = encodeCapture(*state);
+              g_stagingBuffers.release(std::move(state->buffer));
+              return encoded;
+            })
+            .share();
+    g_encoder.post([encoded]() { reportCapture(encoded.get()); });
+    accepted = true;
+  }
+
+  return accepted;
+}
+
+// Uploads the textures that have been decoded since the last frame. Returns
+// true once every texture of the current job is on its way to the GPU.
+static bool updateResourceLoading() {
+  if (g_job.texturesLoaded) {
+    return true;
+  }
+
+  bool loaded = true;
+  for (auto& loader : g_model->resourceLoaders) {
+    loader->asyncUpdateLoad();
+    loaded = loaded && loader->asyncGetLoadProgress() >= 1.0f;
+  }
+
+  if (loaded) {
+    g_job.texturesLoaded = true;
+    statsAt(g_currentJob).textureDecode =
+        fidelity::millisecondsSince(g_job.texturesStart);
+    g_job.warmupStart = fidelity::Clock::now();
+  }
+  return loaded;
+}
+
+static void postRender(
+    Engine* engine, View* view, Scene* scene, Renderer* renderer) {
+  // The interval between two frames of the job, as seen from the render loop
+  fidelity::Clock::time_point now = fidelity::Clock::now();
+  if (g_job.lastFrame != fidelity::Clock::time_point()) {
+    g_job.frameTimeTotal += fidelity::millisecondsBetween(g_job.lastFrame, now);
+    g_job.frameCount++;
+  }
+  g_job.lastFrame = now;
+
+  destroyRetiredModels(engine, scene, 1);
+
+  if (collectCaptures()) {
+    advanceJob(engine, scene);
+    return;
+  }
+
+  // A server that has run out of jobs waits for requests
+  if (g_currentJob >= jobCount()) {
+    if (receiveRequest(engine, scene)) {
+      startJob(engine, scene);
+    }
+    return;
+  }
+
+  if (!g_job.error.empty()) {
+    failJob();
+    advanceJob(engine, scene);
+    return;
+  }
+
+  // Frames rendered while textures are still being decoded do not count
+  // towards the warm-up
+  if (!updateResourceLoading()) {
+    return;
+  }
+
+  g_job.currentFrame++;
+
+  if (g_job.currentFrame <= MIN_WARMUP_FRAMES) {
+    return;
+  }
+
+  if (!g_job.resourcesReady) {
+    // Block until the GPU has executed everything issued so far, which
+    // includes the vertex, index, texture and IBL uploads from setup.
+    Fence::waitAndDestroy(engine->createFence());
+    g_job.resourcesReady = true;
+  }
+
+  if (g_capturesInFlight >= MAX_CAPTURES_IN_FLIGHT) {
+    return;
+  }
+
+  const fidelity::TileLayout layout = tileLayout(jobAt(g_currentJob));
+  const Viewport& vp = view->getViewport();
+  bool final = g_job.currentFrame >= g_maxWarmupFrames;
+
+  // In batch mode the window may not have been resized for this job yet, and
+  // a capture of any other size would be written or compared as is.
+  if (vp.width != layout.tileWidth || vp.height != layout.tileHeight) {
+    if (g_job.currentFrame >= g_maxWarmupFrames + MAX_RESIZE_FRAMES) {
+      std::ostringstream error;
+      error << "The window was not resized to " << layout.tileWidth << "x"
+            << layout.tileHeight << " (it is " << vp.width << "x" << vp.height
+            << ")";
+      g_job.error = error.str();
+    }
+    return;
+  }
+
+  size_t size = vp.width * vp.height * 3 *
+      (g_floatReadback ? sizeof(float) : sizeof(uint8_t));
+  std::unique_ptr<CaptureState> state(new CaptureState);
+  state->jobIndex = g_currentJob;
+  state->tileIndex = g_job.currentTile;
+  state->width = vp.width;
+  state->height = vp.height;
+  state->final = final;
+  state->floatComponents = g_floatReadback;
+  state->golden = g_job.golden;
+  state->buffer = g_stagingBuffers.acquire(size);
+  state->issued = fidelity::Clock::now();
+
+  driver::PixelBufferDescriptor buffer(
+      state->buffer.data.get(),
+      size,
+      driver::PixelBufferDescriptor::PixelDataFormat::RGB,
+      g_floatReadback ? driver::PixelBufferDescriptor::PixelDataType::FLOAT
+                      : driver::PixelBufferDescriptor::PixelDataType::UBYTE,
+      onCaptureRead,
+      state.release());
+
+  g_capturesInFlight++;
+
+  renderer->readPixels(
+      (uint32_t)vp.left,
+      (uint32_t)vp.bottom,
+      vp.width,
+      vp.height,
+      std::move(buffer));
 }
 
 // Reconfigures the window dimensions as necessary so that we take consistently
 // sized screenshots across all display densities. Note that the render scale is
 // not directly related to the display DPI. For example, a MacBook Pro with a
 // reported DPI of 129 might use a scaling factor of 2.0.
+//
+// Headless windows are created without HiDPI support (see filament.patch), so
+// their drawable already has the requested dimensions and is left untouched.
 static void configureWindow(SDL_Window* window) {
+  g_window = window;
+
+  if (g_config.headless) {
+    g_renderScale = 1.0f;
+    return;
+  }
+
   int windowWidth, windowHeight;
   int displayWidth, displayHeight;
   SDL_GetWindowSize(window, &windowWidth, &windowHeight);
   SDL_GL_GetDrawableSize(window, &displayWidth, &displayHeight);
 
   float renderScale = displayWidth / windowWidth;
+  g_renderScale = std::max(renderScale, 1.0f);
 
   std::cout << "Initial window dimensions: " << windowWidth << " x "
             << windowHeight << std::endl;
@@ -367,20 +2516,146 @@ int main(int argc, char* argv[]) {
   int option_index = handleCommandLineArgments(argc, argv, &g_config);
   int num_args = argc - option_index;
 
-  if (num_args < 1) {
-    printUsage(argv[0]);
+  if (!g_manifestPath.empty()) {
+    if (!loadManifest(g_manifestPath, &g_jobs)) {
+      return 1;
+    }
+  } else if (num_args > 0 || g_listenPath.empty()) {
+    if (num_args < 1) {
+      printUsage(argv[0]);
+      return 1;
+    }
+
+    RenderJob job;
+    job.width = g_config.width;
+    job.height = g_config.height;
+    job.iblDirectory = g_config.iblDirectory;
+    job.outputPath = g_config.outputPath;
+    job.frames = g_frames;
+    job.animation = g_animation;
+    job.animationTime = g_animationTime;
+    for (int i = option_index; i < argc; i++) {
+      job.filenames.push_back(Path(argv[i]));
+    }
+
+    if (g_views.empty()) {
+      g_jobs.push_back(job);
+    }
+    for (auto& view : g_views) {
+      RenderJob viewJob;
+      if (!parseView(view, job, &viewJob)) {
+        std::cerr << "view " << view << " is malformed" << std::endl;
+        return 1;
+      }
+      g_jobs.push_back(viewJob);
+    }
+  }
+
+  if (g_jobs.empty() && g_listenPath.empty()) {
+    std::cerr << "no render jobs were specified!" << std::endl;
     return 1;
   }
 
-  for (int i = option_index; i < argc; i++) {
-    utils::Path filename = argv[i];
-    if (!filename.exists()) {
-      std::cerr << "file " << argv[option_index] << " not found!" << std::endl;
+  // Jobs received with --listen are dropped once they have been answered
+  if (!g_listenPath.empty() &&
+      (!g_statsPath.empty() || !g_resultsPath.empty())) {
+    std::cerr << "--stats and --results cannot be combined with --listen!"
+              << std::endl;
+    return 1;
+  }
+
+  if (g_floatReadback && (g_supersampling > 1 || g_maxTileSize > 0)) {
+    std::cerr << "--float-readback cannot be combined with --supersample or "
+                 "--tile-size!"
+              << std::endl;
+    return 1;
+  }
+
+  if (g_maxWarmupFrames == 0) {
+    g_maxWarmupFrames = g_profile->maxWarmupFrames;
+  }
+
+  expandSequences(&g_jobs);
+
+  if (g_compare) {
+    if (g_thresholds.empty()) {
+      std::cerr << "no comparison thresholds were specified!" << std::endl;
       return 1;
     }
-    g_filenames.push_back(filename);
+    for (auto& job : g_jobs) {
+      job.goldenPath = g_goldenPath.empty() ? job.outputPath : g_goldenPath;
+    }
   }
 
+  for (auto& job : g_jobs) {
+    for (auto& filename : job.filenames) {
+      if (!filename.exists()) {
+        std::cerr << "file " << filename << " not found!" << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  if (!g_digestsPath.empty()) {
+    if (!fidelity::readDigests(g_digestsPath, &g_recordedDigests)) {
+      std::cerr << "could not read digests from " << g_digestsPath
+                << std::endl;
+      return 1;
+    }
+    g_digests = g_recordedDigests;
+    if (!fidelity::hashPath("/proc/self/exe", &g_rendererDigest) &&
+        !fidelity::hashPath(argv[0], &g_rendererDigest)) {
+      std::cerr << "could not hash the renderer at " << argv[0] << std::endl;
+      return 1;
+    }
+
+    for (auto& job : g_jobs) {
+      job.inputDigest = inputDigest(job);
+    }
+
+    // Comparisons are always made, as the goldens are not among the inputs
+    if (!g_compare) {
+      size_t count = g_jobs.size();
+      g_jobs.erase(
+          std::remove_if(
+              g_jobs.begin(),
+              g_jobs.end(),
+              [](const RenderJob& job) {
+                auto record = g_recordedDigests.find(job.outputPath);
+                return !job.inputDigest.empty() &&
+                    record != g_recordedDigests.end() &&
+                    record->second.inputs == job.inputDigest &&
+                    Path(job.outputPath).exists();
+              }),
+          g_jobs.end());
+      std::cout << "Skipping " << count - g_jobs.size()
+                << " jobs whose inputs have not changed" << std::endl;
+    }
+
+    if (g_jobs.empty() && g_listenPath.empty()) {
+      return 0;
+    }
+  }
+
+  // The window is created at the tile size of the first job and resized as
+  // subsequent jobs are started. IBLs are loaded per job in setupModel, so
+  // FilamentApp is not asked to load one itself.
+  if (!g_jobs.empty()) {
+    fidelity::TileLayout layout = tileLayout(g_jobs[0]);
+    g_config.width = layout.tileWidth;
+    g_config.height = layout.tileHeight;
+  }
+  g_config.iblDirectory.clear();
+
+  if (!g_listenPath.empty() && !g_server.listen(g_listenPath)) {
+    std::cerr << "could not listen on " << g_listenPath << std::endl;
+    return 1;
+  }
+
+  g_stats.resize(g_jobs.size());
+  g_startTime = fidelity::Clock::now();
+  g_tasks.reset(new fidelity::TaskPool(g_threadCount));
+
   FilamentApp& filamentApp = FilamentApp::get();
   filamentApp.run(
       g_config,
@@ -393,5 +2668,27 @@ int main(int argc, char* argv[]) {
       g_config.width,
       g_config.height);
 
+  // Wait for the last captures to be encoded
+  g_encoder.finish();
+  g_tasks.reset(nullptr);
+  g_server.stop();
+
+  if (g_compare && g_listenPath.empty()) {
+    writeResults();
+  }
+
+  if (!g_digestsPath.empty() &&
+      !fidelity::writeDigests(g_digestsPath, g_digests)) {
+    std::cerr << "Could not write " << g_digestsPath << std::endl;
+  }
+
+  if (!g_statsPath.empty()) {
+    writeStats();
+  }
+
+  if (g_failedJobs > 0) {
+    std::cerr << g_failedJobs << " jobs failed" << std::endl;
+    return 1;
+  }
   return 0;
 }
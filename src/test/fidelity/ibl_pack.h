@@ -0,0 +1,101 @@
+/*
+ * Copyright 2019 Google Inc. All Rights Reserved.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MODEL_VIEWER_FIDELITY_IBL_PACK_H
+#define MODEL_VIEWER_FIDELITY_IBL_PACK_H
+
+// A single-file container for the output of cmgen's deploy option, written
+// by ibl_packer and memory-mapped by gltf_renderer. Everything is stored the
+// way Filament consumes it, so nothing has to be decoded at load time:
+//
+//   IBLPackHeader
+//   reflections: for every mip level, the px, nx, py, ny, pz, nz faces
+//   skybox: the px, nx, py, ny, pz, nz faces
+//
+// Faces are tightly packed, little-endian RGBM (RGBA8) pixels, laid out like
+// the faces of an uncompressed KTX cubemap.
+
+#include "mapped_file.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace fidelity {
+
+constexpr char IBL_PACK_MAGIC[8] = {'F', 'I', 'D', 'L', 'I', 'B', 'L', '\0'};
+constexpr uint32_t IBL_PACK_VERSION = 1;
+constexpr uint32_t IBL_PACK_FACES = 6;
+constexpr uint32_t IBL_PACK_BYTES_PER_PIXEL = 4;
+constexpr uint32_t IBL_PACK_SH_BANDS = 9;
+
+struct IBLPackHeader {
+  char magic[8];
+  uint32_t version;
+  // Offset of the first face from the start of the file
+  uint32_t dataOffset;
+  // Dimensions of a level 0 reflections face; level n is (size >> n) wide
+  uint32_t reflectionsSize;
+  uint32_t reflectionsLevels;
+  uint32_t skyboxSize;
+  uint32_t reserved;
+  // Irradiance spherical harmonics, as found in cmgen's sh.txt
+  float sphericalHarmonics[IBL_PACK_SH_BANDS][3];
+};
+
+inline uint32_t levelSize(uint32_t size, uint32_t level) {
+  uint32_t result = size >> level;
+  return result > 0 ? result : 1;
+}
+
+inline size_t faceBytes(uint32_t size) {
+  return size_t(size) * size * IBL_PACK_BYTES_PER_PIXEL;
+}
+
+// Total size of a pack with the given header, used both to write packs and
+// to validate them before trusting their contents
+inline size_t packBytes(const IBLPackHeader& header) {
+  size_t bytes = header.dataOffset;
+  for (uint32_t level = 0; level < header.reflectionsLevels; level++) {
+    bytes += faceBytes(levelSize(header.reflectionsSize, level)) *
+        IBL_PACK_FACES;
+  }
+  return bytes + faceBytes(header.skyboxSize) * IBL_PACK_FACES;
+}
+
+// Returns the header of a mapped pack, or nullptr if the file is not a pack
+// this version understands or is truncated
+inline const IBLPackHeader* validatePack(const MappedFile& file) {
+  if (file.size() < sizeof(IBLPackHeader)) {
+    return nullptr;
+  }
+
+  const IBLPackHeader* header =
+      reinterpret_cast<const IBLPackHeader*>(file.data());
+  if (memcmp(header->magic, IBL_PACK_MAGIC, sizeof(IBL_PACK_MAGIC)) != 0 ||
+      header->version != IBL_PACK_VERSION ||
+      header->dataOffset < sizeof(IBLPackHeader) ||
+      header->reflectionsSize == 0 || header->reflectionsLevels == 0 ||
+      header->reflectionsLevels > 32 || header->skyboxSize == 0 ||
+      packBytes(*header) > file.size()) {
+    return nullptr;
+  }
+
+  return header;
+}
+
+}  // namespace fidelity
+
+#endif  // MODEL_VIEWER_FIDELITY_IBL_PACK_H
@@ -0,0 +1,173 @@
+/*
+ * Copyright 2019 Google Inc. All Rights Reserved.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ibl_pack.h"
+
+#include <stb_image.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace fidelity;
+
+// The order in which Filament expects cubemap faces
+static const char* FACES[IBL_PACK_FACES] = {"px", "nx", "py", "ny", "pz", "nz"};
+
+static void printUsage(char* name) {
+  std::string usage(
+      "ibl_packer packs the output of cmgen's deploy option into a single\n"
+      "file that gltf_renderer can memory-map\n"
+      "Usage:\n"
+      "    SHOWME <cmgen IBL directory> <output pack>\n");
+  const std::string from("SHOWME");
+  for (size_t pos = usage.find(from); pos != std::string::npos;
+       pos = usage.find(from, pos)) {
+    usage.replace(pos, from.length(), name);
+  }
+  std::cout << usage;
+}
+
+static bool fileExists(const std::string& path) {
+  struct stat info;
+  return stat(path.c_str(), &info) == 0;
+}
+
+// Parses sh.txt the same way samples/app/IBL.cpp does
+static bool readSphericalHarmonics(
+    const std::string& directory, IBLPackHeader* header) {
+  std::ifstream shReader(directory + "/sh.txt");
+  if (!shReader) {
+    std::cerr << "Could not open " << directory << "/sh.txt" << std::endl;
+    return false;
+  }
+
+  shReader >> std::skipws;
+  std::string line;
+  for (auto& band : header->sphericalHarmonics) {
+    std::getline(shReader, line);
+    int n = sscanf(line.c_str(), "(%f,%f,%f)", &band[0], &band[1], &band[2]);
+    if (n != 3) {
+      std::cerr << "Malformed spherical harmonics in " << directory
+                << "/sh.txt" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Decodes the six faces that share the given prefix, appending their pixels
+// to data. Returns the dimensions of the faces, or 0 on failure.
+static uint32_t appendCubemapLevel(
+    const std::string& directory,
+    const std::string& prefix,
+    std::vector<uint8_t>* data) {
+  uint32_t size = 0;
+  for (const char* face : FACES) {
+    std::string path = directory + "/" + prefix + face + ".rgbm";
+    int width, height, channels;
+    std::unique_ptr<uint8_t, void (*)(void*)> pixels(
+        stbi_load(path.c_str(), &width, &height, &channels, 4),
+        stbi_image_free);
+
+    if (!pixels) {
+      std::cerr << "Could not decode " << path << ": " << stbi_failure_reason()
+                << std::endl;
+      return 0;
+    }
+
+    if (width != height || (size != 0 && uint32_t(width) != size)) {
+      std::cerr << path << " does not match the other faces of its cubemap"
+                << std::endl;
+      return 0;
+    }
+
+    size = width;
+    data->insert(data->end(), pixels.get(), pixels.get() + faceBytes(size));
+  }
+  return size;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc != 3) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  const std::string directory(argv[1]);
+  const std::string outputPath(argv[2]);
+
+  IBLPackHeader header = {};
+  memcpy(header.magic, IBL_PACK_MAGIC, sizeof(IBL_PACK_MAGIC));
+  header.version = IBL_PACK_VERSION;
+  // Faces start on a 16 byte boundary
+  header.dataOffset = (sizeof(IBLPackHeader) + 15) & ~15u;
+
+  if (!readSphericalHarmonics(directory, &header)) {
+    return 1;
+  }
+
+  std::vector<uint8_t> data;
+
+  // cmgen writes m<level>_<face>.rgbm down to the smallest mip level
+  for (uint32_t level = 0;; level++) {
+    std::string prefix = "m" + std::to_string(level) + "_";
+    if (!fileExists(directory + "/" + prefix + FACES[0] + ".rgbm")) {
+      break;
+    }
+
+    uint32_t size = appendCubemapLevel(directory, prefix, &data);
+    if (size == 0) {
+      return 1;
+    }
+
+    if (level == 0) {
+      header.reflectionsSize = size;
+    } else if (size != levelSize(header.reflectionsSize, level)) {
+      std::cerr << "Level " << level << " of the reflections is " << size
+                << " wide" << std::endl;
+      return 1;
+    }
+    header.reflectionsLevels = level + 1;
+  }
+
+  if (header.reflectionsLevels == 0) {
+    std::cerr << "No reflections found in " << directory << std::endl;
+    return 1;
+  }
+
+  header.skyboxSize = appendCubemapLevel(directory, "", &data);
+  if (header.skyboxSize == 0) {
+    return 1;
+  }
+
+  std::ofstream out(outputPath, std::ios::binary | std::ios::trunc);
+  std::vector<char> padding(header.dataOffset - sizeof(IBLPackHeader), 0);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out.write(padding.data(), padding.size());
+  out.write(reinterpret_cast<const char*>(data.data()), data.size());
+
+  if (!out) {
+    std::cerr << "Could not write " << outputPath << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
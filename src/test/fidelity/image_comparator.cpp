@@ -0,0 +1,177 @@
+/*
+ * Copyright 2019 Google Inc. All Rights Reserved.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "image_comparator.h"
+#include "image_io.h"
+
+#include <getopt/getopt.h>
+
+#include <stdlib.h>
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace fidelity;
+
+static std::vector<double> g_thresholds = {0.0, 1.0, 10.0};
+static std::string g_outputPath;
+static std::string g_visualsDirectory;
+static size_t g_threadCount = 0;
+
+static void printUsage(char* name) {
+  std::string usage(
+      "image_comparator compares a candidate image to a golden the same way "
+      "the fidelity\n"
+      "tests do, and prints the analysis for each threshold as JSON\n"
+      "Usage:\n"
+      "    image_comparator [options] <candidate png> <golden png>\n"
+      "Options:\n"
+      "   --help, -?\n"
+      "       Prints this message\n\n"
+      "   --thresholds=<list>, -t <list>\n"
+      "       Comma-separated thresholds to analyze at (default: 0,1,10)\n\n"
+      "   --output=<path>, -o <path>\n"
+      "       Writes the JSON analysis to a file instead of stdout\n\n"
+      "   --visuals=<directory>, -v <directory>\n"
+      "       Writes black-white-<threshold>.png and delta-<threshold>.png\n"
+      "       for every threshold to the given directory\n\n"
+      "   --threads=<count>, -j <count>\n"
+      "       Number of threads to use (default: one per core)\n\n");
+  std::cout << usage;
+}
+
+static int handleCommandLineArgments(int argc, char* argv[]) {
+  static constexpr const char* OPTSTR = "?t:o:v:j:";
+  static const struct option OPTIONS[] = {
+      {"help", no_argument, nullptr, '?'},
+      {"thresholds", required_argument, nullptr, 't'},
+      {"output", required_argument, nullptr, 'o'},
+      {"visuals", required_argument, nullptr, 'v'},
+      {"threads", required_argument, nullptr, 'j'},
+      {0, 0, 0, 0}  // termination of the option list
+  };
+  int opt;
+  int option_index = 0;
+  while ((opt = getopt_long(argc, argv, OPTSTR, OPTIONS, &option_index)) >= 0) {
+    std::string arg(optarg ? optarg : "");
+    switch (opt) {
+      default:
+      case '?':
+        printUsage(argv[0]);
+        exit(0);
+      case 't':
+        g_thresholds = parseThresholds(arg);
+        break;
+      case 'o':
+        g_outputPath = arg;
+        break;
+      case 'v':
+        g_visualsDirectory = arg;
+        break;
+      case 'j':
+        g_threadCount = std::stoul(arg);
+        break;
+    }
+  }
+
+  return optind;
+}
+
+static bool writeVisual(
+    const std::string& name,
+    double threshold,
+    const std::vector<uint8_t>& pixels,
+    int width,
+    int height) {
+  std::ostringstream path;
+  path << g_visualsDirectory << "/" << name << "-" << threshold << ".png";
+
+  std::ofstream stream(path.str(), std::ios::binary | std::ios::trunc);
+  if (!stream ||
+      !encodePNG(stream, pixels.data(), width, height, COMPONENTS_PER_PIXEL)) {
+    std::cerr << "Could not write " << path.str() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  int option_index = handleCommandLineArgments(argc, argv);
+  int num_args = argc - option_index;
+
+  if (num_args != 2 || g_thresholds.empty()) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  DecodedImage candidate;
+  DecodedImage golden;
+  if (!decodeImage(argv[option_index], &candidate) ||
+      !decodeImage(argv[option_index + 1], &golden)) {
+    return 1;
+  }
+
+  if (candidate.width != golden.width || candidate.height != golden.height) {
+    std::cerr << "Image sizes do not match (candidate: " << candidate.width
+              << " x " << candidate.height << ", golden: " << golden.width
+              << " x " << golden.height << ")" << std::endl;
+    return 1;
+  }
+
+  ImageComparator comparator(
+      ImageView{candidate.pixels.get()},
+      ImageView{golden.pixels.get()},
+      candidate.width,
+      candidate.height,
+      g_threadCount);
+
+  bool generateVisuals = !g_visualsDirectory.empty();
+  std::vector<ImageComparisonResult> results =
+      comparator.analyze(g_thresholds, generateVisuals);
+
+  if (generateVisuals) {
+    for (size_t i = 0; i < results.size(); i++) {
+      if (!writeVisual(
+              "black-white",
+              g_thresholds[i],
+              results[i].blackWhite,
+              candidate.width,
+              candidate.height) ||
+          !writeVisual(
+              "delta",
+              g_thresholds[i],
+              results[i].delta,
+              candidate.width,
+              candidate.height)) {
+        return 1;
+      }
+    }
+  }
+
+  if (g_outputPath.empty()) {
+    writeAnalysis(std::cout, results);
+    std::cout << std::endl;
+  } else {
+    std::ofstream out(g_outputPath, std::ios::trunc);
+    writeAnalysis(out, results);
+    out << std::endl;
+  }
+
+  return 0;
+}
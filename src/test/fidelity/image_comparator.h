@@ -0,0 +1,502 @@
+/*
+ * Copyright 2019 Google Inc. All Rights Reserved.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MODEL_VIEWER_FIDELITY_IMAGE_COMPARATOR_H
+#define MODEL_VIEWER_FIDELITY_IMAGE_COMPARATOR_H
+
+// A native counterpart of ImageComparator in src/test/fidelity/common.ts. It
+// produces the same statistics and visuals, but evaluates every threshold in
+// a single pass over the images, spreads rows across threads and computes the
+// YIQ color delta of several pixels at once.
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <limits>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define FIDELITY_IMAGE_COMPARATOR_NEON 1
+#endif
+
+namespace fidelity {
+
+// 35215 is the maximum possible value for the YIQ difference metric
+// @see src/test/fidelity/common.ts
+constexpr double MAX_COLOR_DISTANCE = 35215.0;
+
+// Visuals are always RGBA, like their ImageData counterparts
+constexpr uint32_t COMPONENTS_PER_PIXEL = 4;
+
+struct ImageComparisonAnalysis {
+  double matchingRatio = 0.0;
+  double averageDistanceRatio = 0.0;
+  double mismatchingAverageDistanceRatio = 0.0;
+};
+
+struct ImageComparisonResult {
+  ImageComparisonAnalysis analysis;
+  // Only populated when visuals are requested
+  std::vector<uint8_t> blackWhite;
+  std::vector<uint8_t> delta;
+};
+
+// Describes 8-bit pixels to be compared: RGB (alpha is assumed to be opaque)
+// or RGBA, optionally stored bottom row first as they are read back from GL.
+// Color components can be remapped through a 256-entry table, which lets a
+// raw readback be compared against its encoded counterpart.
+struct ImageView {
+  const uint8_t* pixels = nullptr;
+  uint32_t channels = COMPONENTS_PER_PIXEL;
+  bool flipY = false;
+  const uint8_t* table = nullptr;
+};
+
+// Parses a comma-separated list of thresholds such as "0,1,10"
+inline std::vector<double> parseThresholds(const std::string& list) {
+  std::vector<double> thresholds;
+  std::istringstream stream(list);
+  std::string threshold;
+  while (std::getline(stream, threshold, ',')) {
+    if (!threshold.empty()) {
+      thresholds.push_back(std::stod(threshold));
+    }
+  }
+  return thresholds;
+}
+
+// Writes analyses as a JSON array of ImageComparisonAnalysis objects, in the
+// shape the fidelity scripts expect
+inline void writeAnalysis(
+    std::ostream& out, const std::vector<ImageComparisonResult>& results) {
+  std::streamsize precision = out.precision();
+  out << std::setprecision(std::numeric_limits<double>::max_digits10);
+  out << "[";
+  for (size_t i = 0; i < results.size(); i++) {
+    const ImageComparisonAnalysis& analysis = results[i].analysis;
+    out << (i > 0 ? "," : "") << "{\"matchingRatio\":" << analysis.matchingRatio
+        << ",\"averageDistanceRatio\":" << analysis.averageDistanceRatio
+        << ",\"mismatchingAverageDistanceRatio\":"
+        << analysis.mismatchingAverageDistanceRatio << "}";
+  }
+  out << "]";
+  out.precision(precision);
+}
+
+namespace detail {
+
+// Rows of pixels with the golden/candidate components split into separate
+// arrays and blended with white, ready for the delta computation.
+struct BlendedRow {
+  explicit BlendedRow(size_t width)
+      : r(width), g(width), b(width) {
+  }
+  std::vector<double> r;
+  std::vector<double> g;
+  std::vector<double> b;
+};
+
+inline void blendRow(
+    const ImageView& image,
+    uint32_t width,
+    uint32_t height,
+    uint32_t y,
+    BlendedRow* row) {
+  const uint32_t sourceRow = image.flipY ? height - 1 - y : y;
+  const uint8_t* p =
+      image.pixels + size_t(sourceRow) * width * image.channels;
+  const uint8_t* t = image.table;
+  for (uint32_t x = 0; x < width; x++, p += image.channels) {
+    int r = t ? t[p[0]] : p[0];
+    int g = t ? t[p[1]] : p[1];
+    int b = t ? t[p[2]] : p[2];
+    // blend semi-transparent color with white, as pixelmatch does
+    double a = image.channels == 4 ? p[3] / 255.0 : 1.0;
+    row->r[x] = 255 + (r - 255) * a;
+    row->g[x] = 255 + (g - 255) * a;
+    row->b[x] = 255 + (b - 255) * a;
+  }
+}
+
+// The operations below are evaluated in exactly the same order as colorDelta
+// in src/third_party/pixelmatch/color-delta.js, so every path produces the
+// same doubles as the JavaScript implementation.
+inline double colorDelta(
+    double r1, double g1, double b1, double r2, double g2, double b2) {
+  double y = (r1 * 0.29889531 + g1 * 0.58662247 + b1 * 0.11448223) -
+      (r2 * 0.29889531 + g2 * 0.58662247 + b2 * 0.11448223);
+  double i = (r1 * 0.59597799 - g1 * 0.27417610 - b1 * 0.32180189) -
+      (r2 * 0.59597799 - g2 * 0.27417610 - b2 * 0.32180189);
+  double q = (r1 * 0.21147017 - g1 * 0.52261711 + b1 * 0.31114694) -
+      (r2 * 0.21147017 - g2 * 0.52261711 + b2 * 0.31114694);
+  return 0.5053 * y * y + 0.299 * i * i + 0.1957 * q * q;
+}
+
+#if defined(__AVX__)
+using DoubleVector = __m256d;
+constexpr size_t DOUBLE_VECTOR_SIZE = 4;
+inline DoubleVector load(const double* p) {
+  return _mm256_loadu_pd(p);
+}
+inline void store(double* p, DoubleVector v) {
+  _mm256_storeu_pd(p, v);
+}
+inline DoubleVector splat(double v) {
+  return _mm256_set1_pd(v);
+}
+inline DoubleVector add(DoubleVector a, DoubleVector b) {
+  return _mm256_add_pd(a, b);
+}
+inline DoubleVector sub(DoubleVector a, DoubleVector b) {
+  return _mm256_sub_pd(a, b);
+}
+inline DoubleVector mul(DoubleVector a, DoubleVector b) {
+  return _mm256_mul_pd(a, b);
+}
+#define FIDELITY_IMAGE_COMPARATOR_SIMD 1
+#elif defined(__SSE2__)
+using DoubleVector = __m128d;
+constexpr size_t DOUBLE_VECTOR_SIZE = 2;
+inline DoubleVector load(const double* p) {
+  return _mm_loadu_pd(p);
+}
+inline void store(double* p, DoubleVector v) {
+  _mm_storeu_pd(p, v);
+}
+inline DoubleVector splat(double v) {
+  return _mm_set1_pd(v);
+}
+inline DoubleVector add(DoubleVector a, DoubleVector b) {
+  return _mm_add_pd(a, b);
+}
+inline DoubleVector sub(DoubleVector a, DoubleVector b) {
+  return _mm_sub_pd(a, b);
+}
+inline DoubleVector mul(DoubleVector a, DoubleVector b) {
+  return _mm_mul_pd(a, b);
+}
+#define FIDELITY_IMAGE_COMPARATOR_SIMD 1
+#elif defined(FIDELITY_IMAGE_COMPARATOR_NEON)
+using DoubleVector = float64x2_t;
+constexpr size_t DOUBLE_VECTOR_SIZE = 2;
+inline DoubleVector load(const double* p) {
+  return vld1q_f64(p);
+}
+inline void store(double* p, DoubleVector v) {
+  vst1q_f64(p, v);
+}
+inline DoubleVector splat(double v) {
+  return vdupq_n_f64(v);
+}
+inline DoubleVector add(DoubleVector a, DoubleVector b) {
+  return vaddq_f64(a, b);
+}
+inline DoubleVector sub(DoubleVector a, DoubleVector b) {
+  return vsubq_f64(a, b);
+}
+inline DoubleVector mul(DoubleVector a, DoubleVector b) {
+  return vmulq_f64(a, b);
+}
+#define FIDELITY_IMAGE_COMPARATOR_SIMD 1
+#endif
+
+#if defined(FIDELITY_IMAGE_COMPARATOR_SIMD)
+// Evaluates r * c0 + g * c1 + b * c2, or with subtractions where the
+// coefficients are negated in color-delta.js
+inline DoubleVector dot(
+    DoubleVector r,
+    DoubleVector g,
+    DoubleVector b,
+    double c0,
+    double c1,
+    double c2,
+    bool subtractG,
+    bool subtractB) {
+  DoubleVector rc = mul(r, splat(c0));
+  DoubleVector gc = mul(g, splat(c1));
+  DoubleVector bc = mul(b, splat(c2));
+  DoubleVector v = subtractG ? sub(rc, gc) : add(rc, gc);
+  return subtractB ? sub(v, bc) : add(v, bc);
+}
+#endif
+
+inline void computeDeltas(
+    const BlendedRow& candidate,
+    const BlendedRow& golden,
+    uint32_t width,
+    double* deltas) {
+  size_t x = 0;
+#if defined(FIDELITY_IMAGE_COMPARATOR_SIMD)
+  for (; x + DOUBLE_VECTOR_SIZE <= width; x += DOUBLE_VECTOR_SIZE) {
+    DoubleVector r1 = load(&candidate.r[x]);
+    DoubleVector g1 = load(&candidate.g[x]);
+    DoubleVector b1 = load(&candidate.b[x]);
+    DoubleVector r2 = load(&golden.r[x]);
+    DoubleVector g2 = load(&golden.g[x]);
+    DoubleVector b2 = load(&golden.b[x]);
+
+    DoubleVector y = sub(
+        dot(r1, g1, b1, 0.29889531, 0.58662247, 0.11448223, false, false),
+        dot(r2, g2, b2, 0.29889531, 0.58662247, 0.11448223, false, false));
+    DoubleVector i = sub(
+        dot(r1, g1, b1, 0.59597799, 0.27417610, 0.32180189, true, true),
+        dot(r2, g2, b2, 0.59597799, 0.27417610, 0.32180189, true, true));
+    DoubleVector q = sub(
+        dot(r1, g1, b1, 0.21147017, 0.52261711, 0.31114694, true, false),
+        dot(r2, g2, b2, 0.21147017, 0.52261711, 0.31114694, true, false));
+
+    DoubleVector delta = add(
+        add(mul(mul(splat(0.5053), y), y), mul(mul(splat(0.299), i), i)),
+        mul(mul(splat(0.1957), q), q));
+    store(deltas + x, delta);
+  }
+#endif
+  for (; x < width; x++) {
+    deltas[x] = colorDelta(
+        candidate.r[x],
+        candidate.g[x],
+        candidate.b[x],
+        golden.r[x],
+        golden.g[x],
+        golden.b[x]);
+  }
+}
+
+// Per-thread accumulators for a single threshold
+struct ThresholdTotals {
+  size_t matched = 0;
+  double sum = 0.0;
+  double mismatchingSum = 0.0;
+  int maximumDeltaIntensity = 0;
+};
+
+inline void drawPixel(uint8_t* image, size_t position, int r, int g, int b) {
+  image[position + 0] = uint8_t(r);
+  image[position + 1] = uint8_t(g);
+  image[position + 2] = uint8_t(b);
+  image[position + 3] = 255;
+}
+
+// Math.round() for the non-negative values we deal with
+inline int roundHalfUp(double v) {
+  return int(floor(v + 0.5));
+}
+
+}  // namespace detail
+
+class ImageComparator {
+ public:
+  ImageComparator(
+      ImageView candidate,
+      ImageView golden,
+      uint32_t width,
+      uint32_t height,
+      size_t threadCount = 0)
+      : mCandidate(candidate),
+        mGolden(golden),
+        mWidth(width),
+        mHeight(height),
+        mThreadCount(threadCount) {
+    if (mThreadCount == 0) {
+      mThreadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    mThreadCount = std::max<size_t>(1, std::min<size_t>(mThreadCount, height));
+  }
+
+  // Analyzes the images at every given threshold at once, returning one
+  // result per threshold in the same order.
+  std::vector<ImageComparisonResult> analyze(
+      const std::vector<double>& thresholds,
+      bool generateVisuals = true) const {
+    const size_t imagePixels = size_t(mWidth) * mHeight;
+    const size_t thresholdCount = thresholds.size();
+
+    std::vector<ImageComparisonResult> results(thresholdCount);
+    if (generateVisuals) {
+      for (auto& result : results) {
+        result.blackWhite.resize(imagePixels * COMPONENTS_PER_PIXEL);
+        result.delta.resize(imagePixels * COMPONENTS_PER_PIXEL);
+      }
+    }
+
+    std::vector<double> thresholdsSquared(thresholdCount);
+    for (size_t t = 0; t < thresholdCount; t++) {
+      thresholdsSquared[t] = thresholds[t] * thresholds[t];
+    }
+
+    std::vector<std::vector<detail::ThresholdTotals>> totals(
+        mThreadCount, std::vector<detail::ThresholdTotals>(thresholdCount));
+
+    forEachBand([&](size_t band, uint32_t begin, uint32_t end) {
+      detail::BlendedRow candidateRow(mWidth);
+      detail::BlendedRow goldenRow(mWidth);
+      std::vector<double> deltas(mWidth);
+      std::vector<detail::ThresholdTotals>& bandTotals = totals[band];
+
+      for (uint32_t y = begin; y < end; y++) {
+        detail::blendRow(mCandidate, mWidth, mHeight, y, &candidateRow);
+        detail::blendRow(mGolden, mWidth, mHeight, y, &goldenRow);
+        detail::computeDeltas(candidateRow, goldenRow, mWidth, deltas.data());
+
+        for (size_t t = 0; t < thresholdCount; t++) {
+          const double thresholdSquared = thresholdsSquared[t];
+          detail::ThresholdTotals& total = bandTotals[t];
+          uint8_t* blackWhite = generateVisuals ? results[t].blackWhite.data() :
+                                                  nullptr;
+          uint8_t* delta = generateVisuals ? results[t].delta.data() : nullptr;
+
+          for (uint32_t x = 0; x < mWidth; x++) {
+            const double pixelDelta = deltas[x];
+            // Identical pixels match even at a threshold of 0
+            const bool exactlyMatched =
+                pixelDelta == 0.0 || pixelDelta < thresholdSquared;
+
+            if (exactlyMatched) {
+              total.matched++;
+            } else {
+              total.mismatchingSum += pixelDelta;
+            }
+
+            const double thresholdDelta =
+                std::max(0.0, pixelDelta - thresholdSquared);
+
+            total.sum += thresholdDelta;
+
+            if (generateVisuals) {
+              const size_t position =
+                  (size_t(y) * mWidth + x) * COMPONENTS_PER_PIXEL;
+              const int deltaIntensity = detail::roundHalfUp(
+                  255 * thresholdDelta / MAX_COLOR_DISTANCE);
+              const int bw = exactlyMatched ? 255 : 0;
+
+              total.maximumDeltaIntensity =
+                  std::max(deltaIntensity, total.maximumDeltaIntensity);
+
+              detail::drawPixel(blackWhite, position, bw, bw, bw);
+              detail::drawPixel(
+                  delta,
+                  position,
+                  255,
+                  255 - deltaIntensity,
+                  255 - deltaIntensity);
+            }
+          }
+        }
+      }
+    });
+
+    for (size_t t = 0; t < thresholdCount; t++) {
+      detail::ThresholdTotals total;
+      for (size_t band = 0; band < mThreadCount; band++) {
+        const detail::ThresholdTotals& bandTotal = totals[band][t];
+        total.matched += bandTotal.matched;
+        total.sum += bandTotal.sum;
+        total.mismatchingSum += bandTotal.mismatchingSum;
+        total.maximumDeltaIntensity = std::max(
+            total.maximumDeltaIntensity, bandTotal.maximumDeltaIntensity);
+      }
+
+      const size_t mismatchingPixels = imagePixels - total.matched;
+
+      ImageComparisonAnalysis& analysis = results[t].analysis;
+      analysis.matchingRatio = double(total.matched) / imagePixels;
+      analysis.averageDistanceRatio =
+          total.sum / imagePixels / MAX_COLOR_DISTANCE;
+      analysis.mismatchingAverageDistanceRatio = mismatchingPixels > 0 ?
+          total.mismatchingSum / mismatchingPixels / MAX_COLOR_DISTANCE :
+          0.0;
+
+      if (generateVisuals) {
+        normalizeDelta(&results[t].delta, total.maximumDeltaIntensity);
+      }
+    }
+
+    return results;
+  }
+
+ private:
+  // Splits the rows of the image into one contiguous band per thread and
+  // invokes fn(band, beginRow, endRow) for each of them concurrently.
+  template <typename Fn>
+  void forEachBand(Fn fn) const {
+    const uint32_t rowsPerBand =
+        uint32_t((mHeight + mThreadCount - 1) / mThreadCount);
+
+    std::vector<std::thread> threads;
+    for (size_t band = 1; band < mThreadCount; band++) {
+      uint32_t begin = std::min(mHeight, uint32_t(band) * rowsPerBand);
+      uint32_t end = std::min(mHeight, begin + rowsPerBand);
+      threads.emplace_back(fn, band, begin, end);
+    }
+
+    fn(0, 0, std::min(mHeight, rowsPerBand));
+
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  }
+
+  // Rescales the delta visual so that the largest delta is fully saturated.
+  // When nothing differs the JavaScript implementation divides 0 by 0, and
+  // the resulting NaN is stored as 0 by Uint8ClampedArray; that is preserved
+  // here so the visuals stay identical.
+  void normalizeDelta(std::vector<uint8_t>* delta, int maximum) const {
+    uint8_t* pixels = delta->data();
+    forEachBand([&](size_t, uint32_t begin, uint32_t end) {
+      for (uint32_t y = begin; y < end; y++) {
+        for (uint32_t x = 0; x < mWidth; x++) {
+          const size_t position =
+              (size_t(y) * mWidth + x) * COMPONENTS_PER_PIXEL;
+          const int absoluteDeltaIntensity = 255 - pixels[position + 1];
+          const int relativeDeltaIntensity = maximum > 0 ?
+              detail::roundHalfUp(
+                  255 - 255 * (double(absoluteDeltaIntensity) / maximum)) :
+              0;
+
+          detail::drawPixel(
+              pixels,
+              position,
+              255,
+              relativeDeltaIntensity,
+              relativeDeltaIntensity);
+        }
+      }
+    });
+  }
+
+  ImageView mCandidate;
+  ImageView mGolden;
+  uint32_t mWidth;
+  uint32_t mHeight;
+  size_t mThreadCount;
+};
+
+}  // namespace fidelity
+
+#endif  // MODEL_VIEWER_FIDELITY_IMAGE_COMPARATOR_H
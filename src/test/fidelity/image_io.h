@@ -0,0 +1,457 @@
+/*
+ * Copyright 2019 Google Inc. All Rights Reserved.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MODEL_VIEWER_FIDELITY_IMAGE_IO_H
+#define MODEL_VIEWER_FIDELITY_IMAGE_IO_H
+
+#include <png.h>
+#include <stb_image.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace fidelity {
+
+namespace detail {
+
+inline void writePNGData(png_structp png, png_bytep data, png_size_t length) {
+  std::ostream* stream = static_cast<std::ostream*>(png_get_io_ptr(png));
+  stream->write(reinterpret_cast<const char*>(data), length);
+}
+
+inline void flushPNGData(png_structp png) {
+  std::ostream* stream = static_cast<std::ostream*>(png_get_io_ptr(png));
+  stream->flush();
+}
+
+// Row y of an image counted from the top, remapped into row (which holds
+// bytesPerRow bytes) through the table if one is given
+inline const uint8_t* prepareRow(
+    const uint8_t* pixels,
+    uint32_t y,
+    uint32_t height,
+    size_t bytesPerRow,
+    bool flipY,
+    const uint8_t* table,
+    uint8_t* row) {
+  uint32_t sourceRow = flipY ? height - 1 - y : y;
+  const uint8_t* src = pixels + sourceRow * bytesPerRow;
+  if (!table) {
+    return src;
+  }
+  for (size_t i = 0; i < bytesPerRow; i++) {
+    row[i] = table[src[i]];
+  }
+  return row;
+}
+
+// Hands the rows of an image to a callback from top to bottom, remapping
+// every component through the table if one is given
+template <typename Callback>
+inline void forEachRow(
+    const uint8_t* pixels,
+    uint32_t width,
+    uint32_t height,
+    uint32_t channels,
+    bool flipY,
+    const uint8_t* table,
+    Callback callback) {
+  const size_t bytesPerRow = size_t(width) * channels;
+  std::vector<uint8_t> row(table ? bytesPerRow : 0);
+  for (uint32_t y = 0; y < height; y++) {
+    callback(prepareRow(
+        pixels, y, height, bytesPerRow, flipY, table, row.data()));
+  }
+}
+
+inline void writeBigEndian(std::ostream& stream, uint32_t value) {
+  const char bytes[4] = {char(value >> 24), char(value >> 16),
+                         char(value >> 8), char(value)};
+  stream.write(bytes, sizeof(bytes));
+}
+
+inline uint32_t readBigEndian(const uint8_t* bytes) {
+  return uint32_t(bytes[0]) << 24 | uint32_t(bytes[1]) << 16 |
+      uint32_t(bytes[2]) << 8 | uint32_t(bytes[3]);
+}
+
+}  // namespace detail
+
+// zlib settings of the PNG encoder. Lower levels and fewer filters trade file
+// size for encoding time; images that are only ever read by the comparator
+// do not need to be small.
+struct PNGOptions {
+  // 0 (store) to 9 (smallest), or -1 for zlib's default
+  int compressionLevel = -1;
+  // A combination of PNG_FILTER_* flags, or 0 for libpng's default
+  int filters = 0;
+};
+
+// Parses a filter name (none, sub, up, avg, paeth or all) into PNG_FILTER_*
+// flags. Returns false if the name is unknown.
+inline bool parsePNGFilter(const std::string& name, int* filters) {
+  static const struct {
+    const char* name;
+    int filters;
+  } FILTERS[] = {
+      {"none", PNG_FILTER_NONE},
+      {"sub", PNG_FILTER_SUB},
+      {"up", PNG_FILTER_UP},
+      {"avg", PNG_FILTER_AVG},
+      {"paeth", PNG_FILTER_PAETH},
+      {"all", PNG_ALL_FILTERS},
+  };
+  for (auto& filter : FILTERS) {
+    if (name == filter.name) {
+      *filters = filter.filters;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Writes 8-bit RGB (channels = 3) or RGBA (channels = 4) pixels to a PNG, one
+// row at a time, without converting the image to floats first. When a
+// 256-entry table is given, every component is remapped through it as it is
+// written; otherwise rows are handed to libpng as they are.
+inline bool encodePNG(
+    std::ostream& stream,
+    const uint8_t* pixels,
+    uint32_t width,
+    uint32_t height,
+    uint32_t channels,
+    bool flipY = false,
+    const uint8_t* table = nullptr,
+    const PNGOptions& options = PNGOptions()) {
+  png_structp png =
+      png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+  png_infop info = png ? png_create_info_struct(png) : nullptr;
+  if (png == nullptr || info == nullptr) {
+    png_destroy_write_struct(&png, nullptr);
+    return false;
+  }
+
+  // libpng reports errors by jumping back to setjmp, so the row is allocated
+  // before it and every libpng call is made from this frame: the jump must not
+  // skip the destructor of anything that is still alive.
+  const size_t bytesPerRow = size_t(width) * channels;
+  std::vector<uint8_t> row(table ? bytesPerRow : 0);
+
+  if (setjmp(png_jmpbuf(png))) {
+    png_destroy_write_struct(&png, &info);
+    return false;
+  }
+
+  png_set_write_fn(png, &stream, detail::writePNGData, detail::flushPNGData);
+  if (options.compressionLevel >= 0) {
+    png_set_compression_level(png, options.compressionLevel);
+  }
+  if (options.filters != 0) {
+    png_set_filter(png, PNG_FILTER_TYPE_BASE, options.filters);
+  }
+  png_set_IHDR(
+      png,
+      info,
+      width,
+      height,
+      8,
+      channels == 4 ? PNG_COLOR_TYPE_RGBA : PNG_COLOR_TYPE_RGB,
+      PNG_INTERLACE_NONE,
+      PNG_COMPRESSION_TYPE_DEFAULT,
+      PNG_FILTER_TYPE_DEFAULT);
+  png_write_info(png, info);
+
+  for (uint32_t y = 0; y < height; y++) {
+    const uint8_t* src = detail::prepareRow(
+        pixels, y, height, bytesPerRow, flipY, table, row.data());
+    png_write_row(png, const_cast<png_bytep>(src));
+  }
+
+  png_write_end(png, nullptr);
+  png_destroy_write_struct(&png, &info);
+  return true;
+}
+
+// Writes 8-bit RGB pixels to a binary PPM, which costs no more than copying
+// them. Takes the same arguments as encodePNG.
+inline bool encodePPM(
+    std::ostream& stream,
+    const uint8_t* pixels,
+    uint32_t width,
+    uint32_t height,
+    bool flipY = false,
+    const uint8_t* table = nullptr) {
+  stream << "P6\n" << width << " " << height << "\n255\n";
+  const size_t bytesPerRow = size_t(width) * 3;
+  detail::forEachRow(
+      pixels, width, height, 3, flipY, table, [&stream, bytesPerRow](
+          const uint8_t* row) {
+        stream.write(reinterpret_cast<const char*>(row), bytesPerRow);
+      });
+  return bool(stream);
+}
+
+// The "Quite OK Image Format" (https://qoiformat.org), which is lossless,
+// encodes several times faster than PNG and compresses renders nearly as
+// well.
+namespace qoi {
+
+constexpr uint8_t OP_INDEX = 0x00;
+constexpr uint8_t OP_DIFF = 0x40;
+constexpr uint8_t OP_LUMA = 0x80;
+constexpr uint8_t OP_RUN = 0xc0;
+constexpr uint8_t OP_RGB = 0xfe;
+constexpr uint8_t OP_RGBA = 0xff;
+constexpr uint8_t MASK = 0xc0;
+constexpr size_t HEADER_SIZE = 14;
+constexpr uint8_t PADDING[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+struct Pixel {
+  uint8_t r, g, b, a;
+
+  bool operator==(const Pixel& other) const {
+    return r == other.r && g == other.g && b == other.b && a == other.a;
+  }
+};
+
+inline uint32_t hash(const Pixel& p) {
+  return (p.r * 3 + p.g * 5 + p.b * 7 + p.a * 11) % 64;
+}
+
+}  // namespace qoi
+
+// Writes 8-bit RGB (channels = 3) or RGBA (channels = 4) pixels to a QOI
+// image. Takes the same arguments as encodePNG.
+inline bool encodeQOI(
+    std::ostream& stream,
+    const uint8_t* pixels,
+    uint32_t width,
+    uint32_t height,
+    uint32_t channels,
+    bool flipY = false,
+    const uint8_t* table = nullptr) {
+  stream.write("qoif", 4);
+  detail::writeBigEndian(stream, width);
+  detail::writeBigEndian(stream, height);
+  const char format[2] = {char(channels), 0};
+  stream.write(format, sizeof(format));
+
+  qoi::Pixel index[64] = {};
+  qoi::Pixel previous = {0, 0, 0, 255};
+  int run = 0;
+  std::vector<uint8_t> out;
+  out.reserve(size_t(width) * 5);
+
+  uint32_t rowsLeft = height;
+  detail::forEachRow(
+      pixels, width, height, channels, flipY, table, [&](const uint8_t* row) {
+        rowsLeft--;
+        out.clear();
+        for (uint32_t x = 0; x < width; x++) {
+          const uint8_t* src = row + size_t(x) * channels;
+          qoi::Pixel pixel = {
+              src[0], src[1], src[2], channels == 4 ? src[3] : uint8_t(255)};
+          bool last = rowsLeft == 0 && x == width - 1;
+
+          if (pixel == previous) {
+            if (++run == 62 || last) {
+              out.push_back(qoi::OP_RUN | (run - 1));
+              run = 0;
+            }
+            continue;
+          }
+
+          if (run > 0) {
+            out.push_back(qoi::OP_RUN | (run - 1));
+            run = 0;
+          }
+
+          uint32_t position = qoi::hash(pixel);
+          if (index[position] == pixel) {
+            out.push_back(qoi::OP_INDEX | position);
+          } else if (pixel.a != previous.a) {
+            index[position] = pixel;
+            out.insert(
+                out.end(), {qoi::OP_RGBA, pixel.r, pixel.g, pixel.b, pixel.a});
+          } else {
+            index[position] = pixel;
+            int8_t dr = int8_t(pixel.r - previous.r);
+            int8_t dg = int8_t(pixel.g - previous.g);
+            int8_t db = int8_t(pixel.b - previous.b);
+            int8_t drg = int8_t(dr - dg);
+            int8_t dbg = int8_t(db - dg);
+
+            if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 &&
+                db <= 1) {
+              out.push_back(
+                  qoi::OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+            } else if (
+                dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 &&
+                dbg <= 7) {
+              out.push_back(qoi::OP_LUMA | (dg + 32));
+              out.push_back((drg + 8) << 4 | (dbg + 8));
+            } else {
+              out.insert(out.end(), {qoi::OP_RGB, pixel.r, pixel.g, pixel.b});
+            }
+          }
+          previous = pixel;
+        }
+        stream.write(reinterpret_cast<const char*>(out.data()), out.size());
+      });
+
+  stream.write(
+      reinterpret_cast<const char*>(qoi::PADDING), sizeof(qoi::PADDING));
+  return bool(stream);
+}
+
+// Decodes a QOI image in memory to RGBA8. Returns false if it is malformed.
+inline bool decodeQOI(
+    const uint8_t* data,
+    size_t size,
+    std::vector<uint8_t>* pixels,
+    uint32_t* width,
+    uint32_t* height) {
+  if (size < qoi::HEADER_SIZE + sizeof(qoi::PADDING) ||
+      memcmp(data, "qoif", 4) != 0) {
+    return false;
+  }
+
+  *width = detail::readBigEndian(data + 4);
+  *height = detail::readBigEndian(data + 8);
+  const size_t count = size_t(*width) * *height;
+  // Every pixel takes at least a byte, except in runs of up to 62 pixels
+  if (*width == 0 || *height == 0 || count / 62 > size) {
+    return false;
+  }
+  pixels->resize(count * 4);
+
+  qoi::Pixel index[64] = {};
+  qoi::Pixel pixel = {0, 0, 0, 255};
+  const uint8_t* p = data + qoi::HEADER_SIZE;
+  const uint8_t* end = data + size - sizeof(qoi::PADDING);
+  int run = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    if (run > 0) {
+      run--;
+    } else if (p < end) {
+      uint8_t op = *p++;
+      if (op == qoi::OP_RGB) {
+        if (end - p < 3) {
+          return false;
+        }
+        pixel.r = p[0];
+        pixel.g = p[1];
+        pixel.b = p[2];
+        p += 3;
+      } else if (op == qoi::OP_RGBA) {
+        if (end - p < 4) {
+          return false;
+        }
+        pixel = {p[0], p[1], p[2], p[3]};
+        p += 4;
+      } else if ((op & qoi::MASK) == qoi::OP_INDEX) {
+        pixel = index[op];
+      } else if ((op & qoi::MASK) == qoi::OP_DIFF) {
+        pixel.r += ((op >> 4) & 0x03) - 2;
+        pixel.g += ((op >> 2) & 0x03) - 2;
+        pixel.b += (op & 0x03) - 2;
+      } else if ((op & qoi::MASK) == qoi::OP_LUMA) {
+        if (p >= end) {
+          return false;
+        }
+        uint8_t next = *p++;
+        int dg = (op & 0x3f) - 32;
+        pixel.r += dg - 8 + ((next >> 4) & 0x0f);
+        pixel.g += dg;
+        pixel.b += dg - 8 + (next & 0x0f);
+      } else {
+        run = op & 0x3f;
+      }
+      index[qoi::hash(pixel)] = pixel;
+    } else {
+      return false;
+    }
+
+    uint8_t* dst = pixels->data() + i * 4;
+    dst[0] = pixel.r;
+    dst[1] = pixel.g;
+    dst[2] = pixel.b;
+    dst[3] = pixel.a;
+  }
+
+  return true;
+}
+
+struct DecodedImage {
+  std::unique_ptr<uint8_t, void (*)(void*)> pixels{nullptr, stbi_image_free};
+  int width = 0;
+  int height = 0;
+};
+
+// Decodes an image to RGBA8, matching how pngjs hands images to the
+// JavaScript comparator. Besides the formats of stb_image (including PNG and
+// PPM), QOI images are recognized by their signature.
+inline bool decodeImage(const std::string& path, DecodedImage* image) {
+  std::ifstream file(path, std::ios::binary);
+  char signature[4] = {};
+  if (file.read(signature, sizeof(signature)) &&
+      memcmp(signature, "qoif", 4) == 0) {
+    file.seekg(0);
+    std::vector<uint8_t> data(
+        (std::istreambuf_iterator<char>(file)),
+        std::istreambuf_iterator<char>());
+    std::vector<uint8_t> pixels;
+    uint32_t width, height;
+    if (!decodeQOI(data.data(), data.size(), &pixels, &width, &height)) {
+      std::cerr << "Could not decode " << path << ": malformed QOI"
+                << std::endl;
+      return false;
+    }
+
+    // Handed out like the images of stb_image, which frees them with free()
+    uint8_t* copy = static_cast<uint8_t*>(malloc(pixels.size()));
+    std::copy(pixels.begin(), pixels.end(), copy);
+    image->pixels.reset(copy);
+    image->width = int(width);
+    image->height = int(height);
+    return true;
+  }
+
+  int channels;
+  image->pixels.reset(stbi_load(
+      path.c_str(), &image->width, &image->height, &channels, 4));
+  if (!image->pixels) {
+    std::cerr << "Could not decode " << path << ": " << stbi_failure_reason()
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace fidelity
+
+#endif  // MODEL_VIEWER_FIDELITY_IMAGE_IO_H
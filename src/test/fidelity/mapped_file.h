@@ -0,0 +1,81 @@
+/*
+ * Copyright 2019 Google Inc. All Rights Reserved.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MODEL_VIEWER_FIDELITY_MAPPED_FILE_H
+#define MODEL_VIEWER_FIDELITY_MAPPED_FILE_H
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+namespace fidelity {
+
+// A read-only memory mapping of a whole file
+class MappedFile {
+ public:
+  MappedFile() = default;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile() {
+    if (mData != nullptr) {
+      munmap(mData, mSize);
+    }
+  }
+
+  bool open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+      close(fd);
+      return false;
+    }
+
+    void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+      return false;
+    }
+
+    mData = data;
+    mSize = info.st_size;
+    return true;
+  }
+
+  const uint8_t* data() const {
+    return static_cast<const uint8_t*>(mData);
+  }
+
+  size_t size() const {
+    return mSize;
+  }
+
+ private:
+  void* mData = nullptr;
+  size_t mSize = 0;
+};
+
+}  // namespace fidelity
+
+#endif  // MODEL_VIEWER_FIDELITY_MAPPED_FILE_H
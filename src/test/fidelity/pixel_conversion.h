@@ -0,0 +1,256 @@
+/*
+ * Copyright 2019 Google Inc. All Rights Reserved.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MODEL_VIEWER_FIDELITY_PIXEL_CONVERSION_H
+#define MODEL_VIEWER_FIDELITY_PIXEL_CONVERSION_H
+
+// Conversions between normalized integer pixel components and floats. These
+// operate on interleaved components, so they serve RGB8, RGBA8 and RGB16 data
+// alike: pass the total number of components (pixels * channels).
+//
+// Every vectorized path produces bit-identical results to the scalar fallback:
+// integer to float conversions divide (rather than multiply by a reciprocal)
+// and float to integer conversions saturate, scale and round half up. The
+// saturation compares in the operand order of _mm_max_ps and _mm_min_ps in
+// every path, so NaN becomes 0 and infinities saturate alike.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define FIDELITY_PIXEL_CONVERSION_NEON 1
+#endif
+
+namespace fidelity {
+
+namespace scalar {
+
+inline void toFloat(const uint8_t* src, float* dst, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    dst[i] = float(src[i]) / 255.0f;
+  }
+}
+
+inline void toFloat(const uint16_t* src, float* dst, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    dst[i] = float(src[i]) / 65535.0f;
+  }
+}
+
+// Clamps to [0, 1] like _mm_min_ps(_mm_max_ps(v, 0), 1)
+inline float saturate(float v) {
+  v = v > 0.0f ? v : 0.0f;
+  return v < 1.0f ? v : 1.0f;
+}
+
+inline void fromFloat(const float* src, uint8_t* dst, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    dst[i] = uint8_t(saturate(src[i]) * 255.0f + 0.5f);
+  }
+}
+
+inline void fromFloat(const float* src, uint16_t* dst, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    dst[i] = uint16_t(saturate(src[i]) * 65535.0f + 0.5f);
+  }
+}
+
+}  // namespace scalar
+
+// Converts count 8-bit components to floats in [0, 1]
+inline void toFloat(const uint8_t* src, float* dst, size_t count) {
+  size_t i = 0;
+#if defined(__AVX2__)
+  const __m256 scale = _mm256_set1_ps(255.0f);
+  for (; i + 8 <= count; i += 8) {
+    __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i));
+    __m256 v = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+    _mm256_storeu_ps(dst + i, _mm256_div_ps(v, scale));
+  }
+#elif defined(__SSE2__)
+  const __m128 scale = _mm_set1_ps(255.0f);
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= count; i += 16) {
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+    __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+    __m128i words[4] = {_mm_unpacklo_epi16(lo, zero),
+                        _mm_unpackhi_epi16(lo, zero),
+                        _mm_unpacklo_epi16(hi, zero),
+                        _mm_unpackhi_epi16(hi, zero)};
+    for (int j = 0; j < 4; j++) {
+      __m128 v = _mm_cvtepi32_ps(words[j]);
+      _mm_storeu_ps(dst + i + j * 4, _mm_div_ps(v, scale));
+    }
+  }
+#elif defined(FIDELITY_PIXEL_CONVERSION_NEON)
+  const float32x4_t scale = vdupq_n_f32(255.0f);
+  for (; i + 16 <= count; i += 16) {
+    uint8x16_t bytes = vld1q_u8(src + i);
+    uint16x8_t lo = vmovl_u8(vget_low_u8(bytes));
+    uint16x8_t hi = vmovl_u8(vget_high_u8(bytes));
+    uint32x4_t words[4] = {vmovl_u16(vget_low_u16(lo)),
+                           vmovl_u16(vget_high_u16(lo)),
+                           vmovl_u16(vget_low_u16(hi)),
+                           vmovl_u16(vget_high_u16(hi))};
+    for (int j = 0; j < 4; j++) {
+      float32x4_t v = vcvtq_f32_u32(words[j]);
+      vst1q_f32(dst + i + j * 4, vdivq_f32(v, scale));
+    }
+  }
+#endif
+  scalar::toFloat(src + i, dst + i, count - i);
+}
+
+// Converts count 16-bit components to floats in [0, 1]
+inline void toFloat(const uint16_t* src, float* dst, size_t count) {
+  size_t i = 0;
+#if defined(__AVX2__)
+  const __m256 scale = _mm256_set1_ps(65535.0f);
+  for (; i + 8 <= count; i += 8) {
+    __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    __m256 v = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(words));
+    _mm256_storeu_ps(dst + i, _mm256_div_ps(v, scale));
+  }
+#elif defined(__SSE2__)
+  const __m128 scale = _mm_set1_ps(65535.0f);
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 8 <= count; i += 8) {
+    __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+    __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(words, zero));
+    _mm_storeu_ps(dst + i, _mm_div_ps(lo, scale));
+    _mm_storeu_ps(dst + i + 4, _mm_div_ps(hi, scale));
+  }
+#elif defined(FIDELITY_PIXEL_CONVERSION_NEON)
+  const float32x4_t scale = vdupq_n_f32(65535.0f);
+  for (; i + 8 <= count; i += 8) {
+    uint16x8_t words = vld1q_u16(src + i);
+    float32x4_t lo = vcvtq_f32_u32(vmovl_u16(vget_low_u16(words)));
+    float32x4_t hi = vcvtq_f32_u32(vmovl_u16(vget_high_u16(words)));
+    vst1q_f32(dst + i, vdivq_f32(lo, scale));
+    vst1q_f32(dst + i + 4, vdivq_f32(hi, scale));
+  }
+#endif
+  scalar::toFloat(src + i, dst + i, count - i);
+}
+
+// Copies count float components, so that float pixels can be handled like
+// those of the integer formats
+inline void toFloat(const float* src, float* dst, size_t count) {
+  std::copy(src, src + count, dst);
+}
+
+// Converts count floats to 8-bit components, clamping them to [0, 1]
+inline void fromFloat(const float* src, uint8_t* dst, size_t count) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 scale = _mm_set1_ps(255.0f);
+  const __m128 half = _mm_set1_ps(0.5f);
+  for (; i + 16 <= count; i += 16) {
+    __m128i words[4];
+    for (int j = 0; j < 4; j++) {
+      __m128 v = _mm_loadu_ps(src + i + j * 4);
+      v = _mm_min_ps(_mm_max_ps(v, zero), one);
+      v = _mm_add_ps(_mm_mul_ps(v, scale), half);
+      words[j] = _mm_cvttps_epi32(v);
+    }
+    __m128i lo = _mm_packs_epi32(words[0], words[1]);
+    __m128i hi = _mm_packs_epi32(words[2], words[3]);
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+  }
+#elif defined(FIDELITY_PIXEL_CONVERSION_NEON)
+  const float32x4_t zero = vdupq_n_f32(0.0f);
+  const float32x4_t one = vdupq_n_f32(1.0f);
+  const float32x4_t scale = vdupq_n_f32(255.0f);
+  const float32x4_t half = vdupq_n_f32(0.5f);
+  for (; i + 16 <= count; i += 16) {
+    uint16x4_t words[4];
+    for (int j = 0; j < 4; j++) {
+      float32x4_t v = vld1q_f32(src + i + j * 4);
+      // vmaxq_f32 and vminq_f32 would propagate NaN
+      v = vbslq_f32(vcgtq_f32(v, zero), v, zero);
+      v = vbslq_f32(vcltq_f32(v, one), v, one);
+      v = vaddq_f32(vmulq_f32(v, scale), half);
+      words[j] = vmovn_u32(vcvtq_u32_f32(v));
+    }
+    uint8x8_t lo = vmovn_u16(vcombine_u16(words[0], words[1]));
+    uint8x8_t hi = vmovn_u16(vcombine_u16(words[2], words[3]));
+    vst1q_u8(dst + i, vcombine_u8(lo, hi));
+  }
+#endif
+  scalar::fromFloat(src + i, dst + i, count - i);
+}
+
+// Converts count floats to 16-bit components, clamping them to [0, 1]
+inline void fromFloat(const float* src, uint16_t* dst, size_t count) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 scale = _mm_set1_ps(65535.0f);
+  const __m128 half = _mm_set1_ps(0.5f);
+  // SSE2 can only pack with signed saturation, so values are biased into the
+  // signed 16-bit range before packing and unbiased afterwards.
+  const __m128i bias32 = _mm_set1_epi32(32768);
+  const __m128i bias16 = _mm_set1_epi16(-32768);
+  for (; i + 8 <= count; i += 8) {
+    __m128i words[2];
+    for (int j = 0; j < 2; j++) {
+      __m128 v = _mm_loadu_ps(src + i + j * 4);
+      v = _mm_min_ps(_mm_max_ps(v, zero), one);
+      v = _mm_add_ps(_mm_mul_ps(v, scale), half);
+      words[j] = _mm_sub_epi32(_mm_cvttps_epi32(v), bias32);
+    }
+    __m128i packed = _mm_packs_epi32(words[0], words[1]);
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(packed, bias16));
+  }
+#elif defined(FIDELITY_PIXEL_CONVERSION_NEON)
+  const float32x4_t zero = vdupq_n_f32(0.0f);
+  const float32x4_t one = vdupq_n_f32(1.0f);
+  const float32x4_t scale = vdupq_n_f32(65535.0f);
+  const float32x4_t half = vdupq_n_f32(0.5f);
+  for (; i + 8 <= count; i += 8) {
+    uint16x4_t words[2];
+    for (int j = 0; j < 2; j++) {
+      float32x4_t v = vld1q_f32(src + i + j * 4);
+      // vmaxq_f32 and vminq_f32 would propagate NaN
+      v = vbslq_f32(vcgtq_f32(v, zero), v, zero);
+      v = vbslq_f32(vcltq_f32(v, one), v, one);
+      v = vaddq_f32(vmulq_f32(v, scale), half);
+      words[j] = vmovn_u32(vcvtq_u32_f32(v));
+    }
+    vst1q_u16(dst + i, vcombine_u16(words[0], words[1]));
+  }
+#endif
+  scalar::fromFloat(src + i, dst + i, count - i);
+}
+
+}  // namespace fidelity
+
+#endif  // MODEL_VIEWER_FIDELITY_PIXEL_CONVERSION_H
@@ -0,0 +1,192 @@
+/*
+ * Copyright 2019 Google Inc. All Rights Reserved.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MODEL_VIEWER_FIDELITY_READBACK_H
+#define MODEL_VIEWER_FIDELITY_READBACK_H
+
+// Building blocks for overlapping readbacks with the encoding of earlier
+// captures: reusable staging buffers, a queue through which readback
+// callbacks hand their results back to the render loop, and a worker thread
+// that encodes captures in the background. All of them may be used from any
+// thread.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace fidelity {
+
+struct StagingBuffer {
+  std::unique_ptr<uint8_t[]> data;
+  size_t capacity = 0;
+};
+
+// Hands out staging buffers of at least the requested size, reusing those
+// that have been released instead of allocating a new one for every capture.
+// At most maxRetained (unless 0) released buffers are kept, the largest ones,
+// so that a long run of jobs of varying sizes does not keep growing the pool.
+class StagingBufferPool {
+ public:
+  explicit StagingBufferPool(size_t maxRetained = 0)
+      : mMaxRetained(maxRetained) {}
+
+  StagingBuffer acquire(size_t size) {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      for (auto it = mBuffers.begin(); it != mBuffers.end(); ++it) {
+        if (it->capacity >= size) {
+          StagingBuffer buffer = std::move(*it);
+          mBuffers.erase(it);
+          return buffer;
+        }
+      }
+    }
+
+    StagingBuffer buffer;
+    buffer.data.reset(new uint8_t[size]);
+    buffer.capacity = size;
+    return buffer;
+  }
+
+  void release(StagingBuffer buffer) {
+    if (!buffer.data) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mMutex);
+    mBuffers.push_back(std::move(buffer));
+    if (mMaxRetained > 0 && mBuffers.size() > mMaxRetained) {
+      mBuffers.erase(std::min_element(
+          mBuffers.begin(),
+          mBuffers.end(),
+          [](const StagingBuffer& a, const StagingBuffer& b) {
+            return a.capacity < b.capacity;
+          }));
+    }
+  }
+
+  // Frees the released buffers; those in use are kept when released
+  void clear() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mBuffers.clear();
+  }
+
+ private:
+  const size_t mMaxRetained;
+  std::mutex mMutex;
+  std::vector<StagingBuffer> mBuffers;
+};
+
+// A FIFO of completed work, filled by callbacks and drained by the render
+// loop without blocking.
+template <typename T>
+class CompletionQueue {
+ public:
+  void push(T item) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mItems.push_back(std::move(item));
+  }
+
+  bool pop(T* item) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mItems.empty()) {
+      return false;
+    }
+    *item = std::move(mItems.front());
+    mItems.pop_front();
+    return true;
+  }
+
+ private:
+  std::mutex mMutex;
+  std::deque<T> mItems;
+};
+
+// Runs tasks one at a time, in the order they were posted, on a background
+// thread that is started with the first task.
+class Worker {
+ public:
+  // Posting blocks while the given number of tasks is already waiting, unless
+  // it is 0
+  explicit Worker(size_t capacity = 0) : mCapacity(capacity) {}
+  Worker(const Worker&) = delete;
+  Worker& operator=(const Worker&) = delete;
+
+  ~Worker() {
+    finish();
+  }
+
+  void post(std::function<void()> task) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    if (!mThread.joinable()) {
+      mFinishing = false;
+      mThread = std::thread(&Worker::run, this);
+    }
+    mSpace.wait(lock, [this] {
+      return mCapacity == 0 || mTasks.size() < mCapacity;
+    });
+    mTasks.push_back(std::move(task));
+    mCondition.notify_one();
+  }
+
+  // Blocks until every task posted so far has run
+  void finish() {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      if (!mThread.joinable()) {
+        return;
+      }
+      mFinishing = true;
+      mCondition.notify_one();
+    }
+    mThread.join();
+  }
+
+ private:
+  void run() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    for (;;) {
+      mCondition.wait(lock, [this] { return mFinishing || !mTasks.empty(); });
+      if (mTasks.empty()) {
+        return;
+      }
+      std::function<void()> task = std::move(mTasks.front());
+      mTasks.pop_front();
+      mSpace.notify_one();
+      lock.unlock();
+      task();
+      lock.lock();
+    }
+  }
+
+  const size_t mCapacity;
+  std::mutex mMutex;
+  std::condition_variable mCondition;
+  std::condition_variable mSpace;
+  std::deque<std::function<void()>> mTasks;
+  std::thread mThread;
+  bool mFinishing = false;
+};
+
+}  // namespace fidelity
+
+#endif  // MODEL_VIEWER_FIDELITY_READBACK_H
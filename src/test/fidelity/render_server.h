@@ -0,0 +1,267 @@
+/*
+ * Copyright 2019 Google Inc. All Rights Reserved.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MODEL_VIEWER_FIDELITY_RENDER_SERVER_H
+#define MODEL_VIEWER_FIDELITY_RENDER_SERVER_H
+
+// The transport of gltf_renderer --listen: a Unix domain socket on which
+// clients send requests, one per line, and read back the responses in the
+// order the requests were sent. Clients are served one at a time by a
+// listener thread, which hands their requests to the render loop.
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace fidelity {
+
+// How long the listener waits before accepting again after running out of
+// file descriptors
+const std::chrono::milliseconds ACCEPT_RETRY_INTERVAL(100);
+
+// A connected client, which is disconnected once the listener and every
+// pending response are done with it
+class Connection {
+ public:
+  explicit Connection(int fd) : mFd(fd) {
+#if defined(SO_NOSIGPIPE)
+    int enable = 1;
+    setsockopt(mFd, SOL_SOCKET, SO_NOSIGPIPE, &enable, sizeof(enable));
+#endif
+  }
+
+  Connection(const Connection&) = delete;
+  Connection& operator=(const Connection&) = delete;
+
+  ~Connection() {
+    close(mFd);
+  }
+
+  int fd() const {
+    return mFd;
+  }
+
+  // Writes all of the data, unless the client has gone away
+  bool write(const void* data, size_t size) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+#if defined(MSG_NOSIGNAL)
+      ssize_t written = send(mFd, bytes, size, MSG_NOSIGNAL);
+#else
+      ssize_t written = send(mFd, bytes, size, 0);
+#endif
+      if (written <= 0) {
+        return false;
+      }
+      bytes += written;
+      size -= written;
+    }
+    return true;
+  }
+
+  bool write(const std::string& data) {
+    return write(data.data(), data.size());
+  }
+
+ private:
+  std::mutex mMutex;
+  int mFd;
+};
+
+struct Request {
+  std::shared_ptr<Connection> connection;
+  std::string line;
+};
+
+class RenderServer {
+ public:
+  RenderServer() = default;
+  RenderServer(const RenderServer&) = delete;
+  RenderServer& operator=(const RenderServer&) = delete;
+
+  ~RenderServer() {
+    stop();
+  }
+
+  // Starts accepting clients on a socket at the given path, replacing any
+  // socket that a previous server left behind
+  bool listen(const std::string& path) {
+    struct sockaddr_un& address = mAddress;
+    if (path.size() >= sizeof(address.sun_path)) {
+      return false;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    mSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (mSocket < 0) {
+      return false;
+    }
+
+    unlink(path.c_str());
+    if (bind(mSocket, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        ::listen(mSocket, 16) != 0) {
+      close(mSocket);
+      mSocket = -1;
+      return false;
+    }
+
+    mPath = path;
+    mThread = std::thread(&RenderServer::run, this);
+    return true;
+  }
+
+  // Waits up to the timeout for the next request
+  bool receive(Request* request, std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    if (!mCondition.wait_for(
+            lock, timeout, [this] { return !mRequests.empty(); })) {
+      return false;
+    }
+    *request = std::move(mRequests.front());
+    mRequests.pop_front();
+    return true;
+  }
+
+  void stop() {
+    if (mSocket < 0) {
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mStopping = true;
+      if (mClient >= 0) {
+        shutdown(mClient, SHUT_RDWR);
+      }
+    }
+
+    // Connecting wakes up the listener thread if it is waiting for a client
+    int wake = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (wake >= 0) {
+      connect(wake, (struct sockaddr*)&mAddress, sizeof(mAddress));
+      close(wake);
+    }
+    mThread.join();
+
+    close(mSocket);
+    mSocket = -1;
+    unlink(mPath.c_str());
+  }
+
+ private:
+  void run() {
+    for (;;) {
+      int fd = accept(mSocket, nullptr, nullptr);
+      if (fd < 0) {
+        if (stopping()) {
+          return;
+        }
+        if (!isTransient(errno)) {
+          std::cerr << "Could not accept a client: " << strerror(errno)
+                    << std::endl;
+          return;
+        }
+        // Running out of descriptors lasts until earlier clients are done
+        // with, so back off instead of spinning
+        if (errno == EMFILE || errno == ENFILE) {
+          std::cerr << "Could not accept a client: " << strerror(errno)
+                    << std::endl;
+          std::this_thread::sleep_for(ACCEPT_RETRY_INTERVAL);
+        }
+        continue;
+      }
+
+      auto connection = std::make_shared<Connection>(fd);
+      {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mStopping) {
+          return;
+        }
+        mClient = fd;
+      }
+
+      serve(connection);
+
+      std::lock_guard<std::mutex> lock(mMutex);
+      mClient = -1;
+      if (mStopping) {
+        return;
+      }
+    }
+  }
+
+  static bool isTransient(int error) {
+    return error == EINTR || error == ECONNABORTED || error == EMFILE ||
+        error == ENFILE || error == ENOBUFS || error == ENOMEM;
+  }
+
+  bool stopping() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mStopping;
+  }
+
+  // Splits what the client sends into lines until it disconnects
+  void serve(const std::shared_ptr<Connection>& connection) {
+    std::string pending;
+    char buffer[4096];
+    ssize_t size;
+    while ((size = read(connection->fd(), buffer, sizeof(buffer))) > 0) {
+      pending.append(buffer, size);
+
+      size_t end;
+      while ((end = pending.find('\n')) != std::string::npos) {
+        std::string line = pending.substr(0, end);
+        pending.erase(0, end + 1);
+        if (!line.empty() && line.back() == '\r') {
+          line.pop_back();
+        }
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        mRequests.push_back({connection, line});
+        mCondition.notify_one();
+      }
+    }
+  }
+
+  std::string mPath;
+  struct sockaddr_un mAddress;
+  int mSocket = -1;
+  int mClient = -1;
+  bool mStopping = false;
+  std::thread mThread;
+  std::mutex mMutex;
+  std::condition_variable mCondition;
+  std::deque<Request> mRequests;
+};
+
+}  // namespace fidelity
+
+#endif  // MODEL_VIEWER_FIDELITY_RENDER_SERVER_H
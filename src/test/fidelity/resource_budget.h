@@ -0,0 +1,267 @@
+/*
+ * Copyright 2019 Google Inc. All Rights Reserved.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MODEL_VIEWER_FIDELITY_RESOURCE_BUDGET_H
+#define MODEL_VIEWER_FIDELITY_RESOURCE_BUDGET_H
+
+// Estimating how much GPU memory the resources of a model take, and shrinking
+// images that are larger than a render can make use of before they are
+// handed to the loader.
+
+#include <stb_image.h>
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace fidelity {
+
+struct ResourceEstimate {
+  std::string name;
+  size_t bytes = 0;
+};
+
+// An RGBA8 texture with a full mip chain
+inline size_t textureBytes(uint32_t width, uint32_t height) {
+  return size_t(width) * height * 4 * 4 / 3;
+}
+
+// 0 if the file cannot be found
+inline size_t fileSize(const std::string& path) {
+  struct stat info;
+  return stat(path.c_str(), &info) == 0 ? size_t(info.st_size) : 0;
+}
+
+inline size_t totalBytes(const std::vector<ResourceEstimate>& estimates) {
+  size_t total = 0;
+  for (auto& estimate : estimates) {
+    total += estimate.bytes;
+  }
+  return total;
+}
+
+// What an encoded resource turned out to be
+struct PreparedImage {
+  bool isImage = false;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  // An uncompressed TGA of the image, shrunk to fit the maximum size, or
+  // empty if the original is used
+  std::vector<uint8_t> shrunk;
+};
+
+namespace detail {
+
+// Halves an RGBA8 image by averaging 2 x 2 blocks, duplicating the last row
+// or column of odd dimensions
+inline void halveImage(
+    const uint8_t* src,
+    uint32_t width,
+    uint32_t height,
+    std::vector<uint8_t>* dst,
+    uint32_t* halvedWidth,
+    uint32_t* halvedHeight) {
+  const uint32_t w = std::max(width / 2, 1u);
+  const uint32_t h = std::max(height / 2, 1u);
+  dst->resize(size_t(w) * h * 4);
+  for (uint32_t y = 0; y < h; y++) {
+    const uint32_t y0 = std::min(y * 2, height - 1);
+    const uint32_t y1 = std::min(y * 2 + 1, height - 1);
+    for (uint32_t x = 0; x < w; x++) {
+      const uint32_t x0 = std::min(x * 2, width - 1);
+      const uint32_t x1 = std::min(x * 2 + 1, width - 1);
+      const uint8_t* samples[4] = {src + (size_t(y0) * width + x0) * 4,
+                                   src + (size_t(y0) * width + x1) * 4,
+                                   src + (size_t(y1) * width + x0) * 4,
+                                   src + (size_t(y1) * width + x1) * 4};
+      uint8_t* out = dst->data() + (size_t(y) * w + x) * 4;
+      for (int c = 0; c < 4; c++) {
+        out[c] = uint8_t(
+            (samples[0][c] + samples[1][c] + samples[2][c] + samples[3][c] +
+             2) /
+            4);
+      }
+    }
+  }
+  *halvedWidth = w;
+  *halvedHeight = h;
+}
+
+// Uncompressed 32-bit TGA with a top-left origin, which stb_image (and thus
+// the loader) decodes without any work beyond swizzling
+inline void encodeTGA(
+    const uint8_t* rgba,
+    uint32_t width,
+    uint32_t height,
+    std::vector<uint8_t>* tga) {
+  const size_t headerSize = 18;
+  tga->assign(headerSize + size_t(width) * height * 4, 0);
+  uint8_t* header = tga->data();
+  header[2] = 2;  // uncompressed true color
+  header[12] = uint8_t(width);
+  header[13] = uint8_t(width >> 8);
+  header[14] = uint8_t(height);
+  header[15] = uint8_t(height >> 8);
+  header[16] = 32;
+  header[17] = 0x28;  // 8 bits of alpha, top-left origin
+
+  uint8_t* out = tga->data() + headerSize;
+  for (size_t i = 0; i < size_t(width) * height; i++, rgba += 4, out += 4) {
+    out[0] = rgba[2];
+    out[1] = rgba[1];
+    out[2] = rgba[0];
+    out[3] = rgba[3];
+  }
+}
+
+}  // namespace detail
+
+// The JSON of a glTF file, or the JSON chunk of a GLB. Sets *json to null if
+// a GLB is truncated.
+inline void gltfJson(const uint8_t* data, size_t size,
+    const char** json, size_t* jsonSize) {
+  *json = reinterpret_cast<const char*>(data);
+  *jsonSize = size;
+  if (size < 4 || memcmp(data, "glTF", 4) != 0) {
+    return;
+  }
+
+  // 12-byte header, then the JSON chunk's length, type and data
+  uint32_t length = 0;
+  if (size >= 20) {
+    memcpy(&length, data + 12, 4);
+  }
+  if (size < 20 || length > size - 20 || memcmp(data + 16, "JSON", 4) != 0) {
+    *json = nullptr;
+    *jsonSize = 0;
+    return;
+  }
+  *json += 20;
+  *jsonSize = length;
+}
+
+// The "uri" members of the entries of the top-level "images" array, as
+// written (gltfio reports URIs without unescaping them). Only tracks nesting
+// and strings, which is all that is needed to tell images from buffers.
+inline std::set<std::string> imageUris(const char* json, size_t size) {
+  std::set<std::string> uris;
+  std::string nesting;
+  std::string key;
+  bool inImages = false;
+
+  for (size_t i = 0; i < size; i++) {
+    char c = json[i];
+    if (c == '"') {
+      size_t start = ++i;
+      while (i < size && json[i] != '"') {
+        i += json[i] == '\\' ? 2 : 1;
+      }
+      std::string value(json + start, std::min(i, size) - start);
+
+      size_t next = i + 1;
+      while (next < size && isspace(static_cast<unsigned char>(json[next]))) {
+        next++;
+      }
+      if (next < size && json[next] == ':') {
+        key = value;
+      } else if (inImages && nesting == "{[{" && key == "uri") {
+        uris.insert(value);
+      }
+    } else if (c == '{' || c == '[') {
+      if (nesting == "{" && c == '[') {
+        inImages = key == "images";
+      }
+      nesting += c;
+    } else if ((c == '}' || c == ']') && !nesting.empty()) {
+      nesting.pop_back();
+    }
+  }
+  return uris;
+}
+
+// Inspects an encoded resource and, if it is an image with a side longer than
+// maxSize (unless 0), decodes it and halves it until it fits.
+inline PreparedImage prepareImage(
+    const uint8_t* data, size_t size, uint32_t maxSize) {
+  PreparedImage image;
+  int width, height, channels;
+  if (!stbi_info_from_memory(data, int(size), &width, &height, &channels)) {
+    return image;
+  }
+  image.isImage = true;
+  image.width = width;
+  image.height = height;
+
+  if (maxSize == 0 || (image.width <= maxSize && image.height <= maxSize)) {
+    return image;
+  }
+
+  uint8_t* decoded =
+      stbi_load_from_memory(data, int(size), &width, &height, &channels, 4);
+  if (decoded == nullptr) {
+    return image;
+  }
+
+  std::vector<uint8_t> pixels(decoded, decoded + size_t(width) * height * 4);
+  stbi_image_free(decoded);
+
+  std::vector<uint8_t> halved;
+  uint32_t w = width, h = height;
+  while (w > maxSize || h > maxSize) {
+    detail::halveImage(pixels.data(), w, h, &halved, &w, &h);
+    pixels.swap(halved);
+  }
+
+  image.width = w;
+  image.height = h;
+  detail::encodeTGA(pixels.data(), w, h, &image.shrunk);
+  return image;
+}
+
+// Lists the largest resources of a model that exceeds its budget
+inline void writeBudgetReport(
+    std::ostream& out,
+    const std::string& job,
+    std::vector<ResourceEstimate> estimates,
+    size_t budget) {
+  const double MEBIBYTE = 1024.0 * 1024.0;
+  out << job << ": the model needs an estimated "
+      << totalBytes(estimates) / MEBIBYTE
+      << " MiB, which exceeds the budget of " << budget / MEBIBYTE
+      << " MiB. Its largest resources are:" << std::endl;
+
+  std::sort(
+      estimates.begin(),
+      estimates.end(),
+      [](const ResourceEstimate& a, const ResourceEstimate& b) {
+        return a.bytes > b.bytes;
+      });
+  for (size_t i = 0; i < std::min(estimates.size(), size_t(5)); i++) {
+    out << "    " << estimates[i].name << ": " << estimates[i].bytes / MEBIBYTE
+        << " MiB" << std::endl;
+  }
+}
+
+}  // namespace fidelity
+
+#endif  // MODEL_VIEWER_FIDELITY_RESOURCE_BUDGET_H
@@ -0,0 +1,91 @@
+/*
+ * Copyright 2019 Google Inc. All Rights Reserved.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MODEL_VIEWER_FIDELITY_STATS_H
+#define MODEL_VIEWER_FIDELITY_STATS_H
+
+// Helpers for the per-stage instrumentation of the fidelity tools
+
+#include <sys/resource.h>
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include <chrono>
+#include <ostream>
+#include <string>
+
+namespace fidelity {
+
+using Clock = std::chrono::steady_clock;
+
+inline double millisecondsBetween(
+    Clock::time_point start, Clock::time_point end) {
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+inline double millisecondsSince(Clock::time_point start) {
+  return millisecondsBetween(start, Clock::now());
+}
+
+// Peak resident set size of the process so far
+inline size_t peakResidentBytes() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+#if defined(__APPLE__)
+  return size_t(usage.ru_maxrss);
+#else
+  // Linux reports kilobytes
+  return size_t(usage.ru_maxrss) * 1024;
+#endif
+}
+
+inline void writeJSONString(std::ostream& out, const std::string& value) {
+  out << '"';
+  for (char c : value) {
+    switch (c) {
+      case '"':
+        out << "\\\"";
+        break;
+      case '\\':
+        out << "\\\\";
+        break;
+      case '\n':
+        out << "\\n";
+        break;
+      case '\r':
+        out << "\\r";
+        break;
+      case '\t':
+        out << "\\t";
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char escaped[7];
+          snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+          out << escaped;
+        } else {
+          out << c;
+        }
+    }
+  }
+  out << '"';
+}
+
+}  // namespace fidelity
+
+#endif  // MODEL_VIEWER_FIDELITY_STATS_H
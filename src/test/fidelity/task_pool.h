@@ -0,0 +1,161 @@
+/*
+ * Copyright 2019 Google Inc. All Rights Reserved.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MODEL_VIEWER_FIDELITY_TASK_POOL_H
+#define MODEL_VIEWER_FIDELITY_TASK_POOL_H
+
+// A pool of threads that runs independent tasks (image decoding, comparing
+// and encoding captures, writing files) off the render thread. Every thread
+// has a queue of its own: tasks submitted by a pool thread go to its queue,
+// others are spread over the queues in turn, and a thread whose queue is
+// empty steals the oldest task of another.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace fidelity {
+
+class TaskPool {
+ public:
+  // A thread count of 0 uses one thread per core
+  explicit TaskPool(size_t threadCount = 0) {
+    if (threadCount == 0) {
+      threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    for (size_t i = 0; i < threadCount; i++) {
+      mQueues.emplace_back(new Queue);
+    }
+    for (size_t i = 0; i < threadCount; i++) {
+      mThreads.emplace_back(&TaskPool::run, this, i);
+    }
+  }
+
+  TaskPool(const TaskPool&) = delete;
+  TaskPool& operator=(const TaskPool&) = delete;
+
+  // Runs the tasks that are still queued before returning
+  ~TaskPool() {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mStopping = true;
+      mCondition.notify_all();
+    }
+    for (auto& thread : mThreads) {
+      thread.join();
+    }
+  }
+
+  template <typename Function>
+  std::future<typename std::result_of<Function()>::type> submit(
+      Function function) {
+    using Result = typename std::result_of<Function()>::type;
+    auto task = std::make_shared<std::packaged_task<Result()>>(function);
+    std::future<Result> result = task->get_future();
+
+    size_t index = currentIndex() < mQueues.size()
+        ? currentIndex()
+        : mNext.fetch_add(1) % mQueues.size();
+    {
+      std::lock_guard<std::mutex> lock(mQueues[index]->mutex);
+      mQueues[index]->tasks.push_back([task]() { (*task)(); });
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mPending++;
+    mCondition.notify_one();
+    return result;
+  }
+
+ private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  // Index of the pool thread that is calling, or SIZE_MAX off the pool
+  static size_t& currentIndex() {
+    static thread_local size_t index = SIZE_MAX;
+    return index;
+  }
+
+  // The newest task of the thread's own queue, or else the oldest of the
+  // first other queue that has one
+  bool take(size_t index, std::function<void()>* task) {
+    for (size_t i = 0; i < mQueues.size(); i++) {
+      Queue& queue = *mQueues[(index + i) % mQueues.size()];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (queue.tasks.empty()) {
+        continue;
+      }
+      if (i == 0) {
+        *task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+      } else {
+        *task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+      }
+      return true;
+    }
+    return false;
+  }
+
+  // A thread claims a pending task before it takes one from the queues, and
+  // busy-yields until it can: another thread may have stolen the task that
+  // was queued for it, while the task it will take is still being queued.
+  void run(size_t index) {
+    currentIndex() = index;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCondition.wait(lock, [this] { return mStopping || mPending > 0; });
+        if (mPending == 0) {
+          return;
+        }
+        mPending--;
+      }
+
+      // Every pending task has been queued before it was counted, so the
+      // task this thread claimed is in one of the queues
+      std::function<void()> task;
+      while (!take(index, &task)) {
+        std::this_thread::yield();
+      }
+      task();
+    }
+  }
+
+  std::vector<std::unique_ptr<Queue>> mQueues;
+  std::vector<std::thread> mThreads;
+  std::atomic<size_t> mNext{0};
+  std::mutex mMutex;
+  std::condition_variable mCondition;
+  size_t mPending = 0;
+  bool mStopping = false;
+};
+
+}  // namespace fidelity
+
+#endif  // MODEL_VIEWER_FIDELITY_TASK_POOL_H
@@ -0,0 +1,152 @@
+/*
+ * Copyright 2019 Google Inc. All Rights Reserved.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MODEL_VIEWER_FIDELITY_TILING_H
+#define MODEL_VIEWER_FIDELITY_TILING_H
+
+// Splitting a (possibly supersampled) render into tiles, and assembling the
+// tiles back into the final image. Pixel rows are counted from the bottom, as
+// they are read back from GL.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace fidelity {
+
+struct TileLayout {
+  // Dimensions of the whole render, i.e. the output times the supersampling
+  uint32_t renderWidth = 0;
+  uint32_t renderHeight = 0;
+  uint32_t supersampling = 1;
+  // Tiles along the right and top edges extend past the render
+  uint32_t tileWidth = 0;
+  uint32_t tileHeight = 0;
+  uint32_t columns = 1;
+  uint32_t rows = 1;
+
+  uint32_t tileCount() const {
+    return columns * rows;
+  }
+
+  bool isSingleTile() const {
+    return columns == 1 && rows == 1 && supersampling == 1;
+  }
+};
+
+// A maximum tile size of 0 renders everything in a single tile
+inline TileLayout makeTileLayout(
+    uint32_t width,
+    uint32_t height,
+    uint32_t supersampling,
+    uint32_t maxTileSize) {
+  TileLayout layout;
+  layout.supersampling = std::max(supersampling, 1u);
+  layout.renderWidth = width * layout.supersampling;
+  layout.renderHeight = height * layout.supersampling;
+  layout.tileWidth = maxTileSize > 0
+      ? std::min(layout.renderWidth, maxTileSize)
+      : layout.renderWidth;
+  layout.tileHeight = maxTileSize > 0
+      ? std::min(layout.renderHeight, maxTileSize)
+      : layout.renderHeight;
+  layout.columns =
+      (layout.renderWidth + layout.tileWidth - 1) / layout.tileWidth;
+  layout.rows =
+      (layout.renderHeight + layout.tileHeight - 1) / layout.tileHeight;
+  return layout;
+}
+
+// Origin of a tile within the render; tiles are ordered row by row, starting
+// from the bottom left
+inline void tileOrigin(
+    const TileLayout& layout, uint32_t tile, uint32_t* x, uint32_t* y) {
+  *x = (tile % layout.columns) * layout.tileWidth;
+  *y = (tile / layout.columns) * layout.tileHeight;
+}
+
+// Restricts a symmetric frustum, spanning [-right, right] and [-top, top] on
+// the near plane, to the part that a tile covers
+inline void tileFrustum(
+    const TileLayout& layout,
+    uint32_t tile,
+    double right,
+    double top,
+    double* tileLeft,
+    double* tileRight,
+    double* tileBottom,
+    double* tileTop) {
+  uint32_t x, y;
+  tileOrigin(layout, tile, &x, &y);
+  double width = 2.0 * right / layout.renderWidth;
+  double height = 2.0 * top / layout.renderHeight;
+  *tileLeft = -right + x * width;
+  *tileRight = -right + (x + layout.tileWidth) * width;
+  *tileBottom = -top + y * height;
+  *tileTop = -top + (y + layout.tileHeight) * height;
+}
+
+// Copies the part of an RGB8 tile that lies within the render into place
+inline void copyTile(
+    const TileLayout& layout,
+    uint32_t tile,
+    const uint8_t* pixels,
+    uint8_t* render) {
+  uint32_t x, y;
+  tileOrigin(layout, tile, &x, &y);
+  const uint32_t width = std::min(layout.tileWidth, layout.renderWidth - x);
+  const uint32_t height = std::min(layout.tileHeight, layout.renderHeight - y);
+  for (uint32_t row = 0; row < height; row++) {
+    memcpy(render + (size_t(y + row) * layout.renderWidth + x) * 3,
+           pixels + size_t(row) * layout.tileWidth * 3,
+           size_t(width) * 3);
+  }
+}
+
+// Resolves a supersampled RGB8 render by averaging every factor x factor
+// block of pixels, rounding to nearest
+inline void downsample(
+    const uint8_t* src,
+    uint32_t width,
+    uint32_t height,
+    uint32_t factor,
+    uint8_t* dst) {
+  const uint32_t samples = factor * factor;
+  const size_t srcStride = size_t(width) * factor * 3;
+  for (uint32_t y = 0; y < height; y++) {
+    for (uint32_t x = 0; x < width; x++) {
+      uint32_t sums[3] = {0, 0, 0};
+      for (uint32_t sy = 0; sy < factor; sy++) {
+        const uint8_t* p = src + (size_t(y) * factor + sy) * srcStride +
+            size_t(x) * factor * 3;
+        for (uint32_t sx = 0; sx < factor; sx++, p += 3) {
+          sums[0] += p[0];
+          sums[1] += p[1];
+          sums[2] += p[2];
+        }
+      }
+      uint8_t* q = dst + (size_t(y) * width + x) * 3;
+      for (int c = 0; c < 3; c++) {
+        q[c] = uint8_t((sums[c] + samples / 2) / samples);
+      }
+    }
+  }
+}
+
+}  // namespace fidelity
+
+#endif  // MODEL_VIEWER_FIDELITY_TILING_H
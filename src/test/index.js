@@ -30,3 +30,4 @@ import './features/loading-spec.js';
 import './features/loading/status-announcer-spec.js';
 import './features/magic-leap-spec.js';
 import './features/ar-spec.js';
+import './fidelity/common-spec.js';